@@ -661,6 +661,18 @@ __SYSCALL(__NR_pwritev, sys_pwritev)
 __SYSCALL(__NR_rt_tgsigqueueinfo, sys_rt_tgsigqueueinfo)
 #define __NR_perf_event_open			298
 __SYSCALL(__NR_perf_event_open, sys_perf_event_open)
+#define __NR_recvmmsg				299
+__SYSCALL(__NR_recvmmsg, sys_recvmmsg)
+/* numbered as upstream; 300-306 are left to sys_ni_syscall */
+#define __NR_sendmmsg				307
+__SYSCALL(__NR_sendmmsg, sys_sendmmsg)
+/* 308-424 are left to sys_ni_syscall as well */
+#define __NR_io_uring_setup			425
+__SYSCALL(__NR_io_uring_setup, sys_io_uring_setup)
+#define __NR_io_uring_enter			426
+__SYSCALL(__NR_io_uring_enter, sys_io_uring_enter)
+#define __NR_io_uring_register			427
+__SYSCALL(__NR_io_uring_register, sys_io_uring_register)
 
 #ifndef __NO_STUBS
 #define __ARCH_WANT_OLD_READDIR
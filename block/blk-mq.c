@@ -0,0 +1,744 @@
+/*
+ * Multi-queue block I/O queueing.
+ *
+ * A queue set up with blk_mq_init_queue() bypasses the elevator and the
+ * queue_lock entirely.  Bios are turned into requests on a per-cpu
+ * software queue (struct blk_mq_ctx), and each software queue feeds one
+ * of the device's hardware dispatch contexts (struct blk_mq_hw_ctx).
+ * Requests are preallocated per hardware context and indexed by tag, so
+ * getting one is a bit operation rather than a mempool allocation under
+ * a shared lock.  Completions are pushed back to the submitting cpu
+ * through the block softirq.
+ *
+ * Only simple back merges against the most recent requests of the local
+ * software queue are attempted; there is no sorting and no I/O
+ * scheduling.  Barriers are passed straight to the driver if it declared
+ * QUEUE_ORDERED_TAG and are failed with -EOPNOTSUPP otherwise.  Drivers
+ * that need the drain/flush sequencing of the elevator path should stay
+ * on blk_init_queue().
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/writeback.h>
+
+#include "blk.h"
+
+/*
+ * How many requests of the local software queue are checked for a back
+ * merge before giving up.
+ */
+#define BLK_MQ_MERGE_DEPTH	8
+
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+	unsigned long		*bitmap;	/* busy tags */
+	struct request		**rqs;		/* preallocated, by tag */
+	wait_queue_head_t	wait;		/* waiting for a free tag */
+};
+
+static void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	unsigned int i;
+
+	if (!tags)
+		return;
+
+	if (tags->rqs) {
+		for (i = 0; i < tags->nr_tags; i++)
+			kfree(tags->rqs[i]);
+		kfree(tags->rqs);
+	}
+	kfree(tags->bitmap);
+	kfree(tags);
+}
+
+static struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags,
+					    size_t rq_size, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int i;
+
+	tags = kzalloc_node(sizeof(*tags), GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+
+	tags->bitmap = kzalloc_node(BITS_TO_LONGS(nr_tags) * sizeof(long),
+				    GFP_KERNEL, node);
+	tags->rqs = kzalloc_node(nr_tags * sizeof(struct request *),
+				 GFP_KERNEL, node);
+	if (!tags->bitmap || !tags->rqs)
+		goto fail;
+
+	/*
+	 * One allocation per request keeps these at kmalloc sizes, the
+	 * whole set would need a high order allocation.
+	 */
+	for (i = 0; i < nr_tags; i++) {
+		tags->rqs[i] = kmalloc_node(rq_size, GFP_KERNEL, node);
+		if (!tags->rqs[i])
+			goto fail;
+	}
+	return tags;
+
+fail:
+	blk_mq_free_tags(tags);
+	return NULL;
+}
+
+/*
+ * Grab a free tag, searching from @hint so that cpus sharing a hardware
+ * context do not all fight over the first word of the bitmap.
+ */
+static int __blk_mq_get_tag(struct blk_mq_tags *tags, unsigned int hint)
+{
+	unsigned int tag;
+
+	if (hint >= tags->nr_tags)
+		hint = 0;
+again:
+	tag = find_next_zero_bit(tags->bitmap, tags->nr_tags, hint);
+	if (tag >= tags->nr_tags) {
+		if (!hint)
+			return -1;
+		hint = 0;
+		goto again;
+	}
+	if (test_and_set_bit_lock(tag, tags->bitmap)) {
+		hint = tag;
+		goto again;
+	}
+	return tag;
+}
+
+static int blk_mq_get_tag(struct blk_mq_hw_ctx *hctx, struct blk_mq_ctx *ctx,
+			  gfp_t gfp_mask)
+{
+	struct blk_mq_tags *tags = hctx->tags;
+	DEFINE_WAIT(wait);
+	int tag;
+
+	tag = __blk_mq_get_tag(tags, ctx->last_tag);
+	if (tag < 0 && (gfp_mask & __GFP_WAIT)) {
+		for (;;) {
+			/* push out what is queued so that tags get freed */
+			blk_mq_run_hw_queue(hctx, false);
+
+			prepare_to_wait(&tags->wait, &wait,
+					TASK_UNINTERRUPTIBLE);
+			tag = __blk_mq_get_tag(tags, ctx->last_tag);
+			if (tag >= 0)
+				break;
+			io_schedule();
+		}
+		finish_wait(&tags->wait, &wait);
+	}
+
+	if (tag >= 0)
+		ctx->last_tag = tag + 1;
+	return tag;
+}
+
+static void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	clear_bit_unlock(tag, tags->bitmap);
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
+
+static inline struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+						  unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * The cpu is only used to pick a software queue: a request queued on the
+ * context of a cpu we have since migrated away from, or that went offline,
+ * is still dispatched by its hardware context.
+ */
+static inline struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, raw_smp_processor_id());
+}
+
+/**
+ * blk_mq_map_queue - default cpu to hardware context mapping
+ * @q:		the queue
+ * @cpu:	the submitting cpu
+ *
+ * Spreads the possible cpus evenly over the hardware contexts, keeping
+ * neighbouring cpu numbers on the same context.
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static struct request *__blk_mq_alloc_request(struct request_queue *q,
+					      struct blk_mq_ctx *ctx,
+					      int rw, gfp_t gfp_mask)
+{
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+	struct request *rq;
+	int tag;
+
+	tag = blk_mq_get_tag(hctx, ctx, gfp_mask);
+	if (tag < 0)
+		return NULL;
+
+	rq = hctx->tags->rqs[tag];
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cpu = ctx->cpu;
+	rq->cmd_flags = rw;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+	return rq;
+}
+
+/**
+ * blk_mq_alloc_request - get a request from a multi-queue device
+ * @q:		the queue
+ * @rw:		READ or WRITE, possibly with REQ_* flags
+ * @gfp_mask:	if __GFP_WAIT is set, sleep until a tag frees up
+ *
+ * The request comes from the hardware context of the local cpu.  Free it
+ * with blk_mq_free_request() or blk_put_request().
+ */
+struct request *blk_mq_alloc_request(struct request_queue *q, int rw,
+				     gfp_t gfp_mask)
+{
+	return __blk_mq_alloc_request(q, blk_mq_get_ctx(q), rw, gfp_mask);
+}
+EXPORT_SYMBOL(blk_mq_alloc_request);
+
+void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+
+	blk_mq_put_tag(hctx->tags, rq->tag);
+}
+EXPORT_SYMBOL(blk_mq_free_request);
+
+static void blk_mq_account_done(struct request *rq)
+{
+	if (blk_do_io_stat(rq)) {
+		unsigned long duration = jiffies - rq->start_time;
+		const int rw = rq_data_dir(rq);
+		struct hd_struct *part;
+		int cpu;
+
+		cpu = part_stat_lock();
+		part = disk_map_sector_rcu(rq->rq_disk, blk_rq_pos(rq));
+		part_stat_inc(cpu, part, ios[rw]);
+		part_stat_add(cpu, part, ticks[rw], duration);
+		part_stat_unlock();
+	}
+}
+
+/**
+ * blk_mq_end_io - end all of a request
+ * @rq:		the request
+ * @error:	0 for success, < 0 for error
+ *
+ * Completes every bio of @rq and releases its tag, or hands it to
+ * ->end_io if one is set.  Called by the driver, in any context.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	if (unlikely(laptop_mode) && blk_fs_request(rq))
+		laptop_io_completion();
+
+	add_disk_randomness(rq->rq_disk);
+	blk_mq_account_done(rq);
+
+	if (rq->end_io)
+		rq->end_io(rq, error);
+	else
+		blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+/**
+ * blk_mq_complete_request - end a request on the cpu that submitted it
+ * @rq:		the request, with ->errors set
+ *
+ * Meant for the driver's interrupt handler: ->complete will be called
+ * from the block softirq of the submitting cpu, or directly if the driver
+ * has no ->complete.
+ */
+void blk_mq_complete_request(struct request *rq)
+{
+	if (!rq->q->softirq_done_fn) {
+		blk_mq_end_io(rq, rq->errors);
+		return;
+	}
+	if (!blk_mark_rq_complete(rq))
+		__blk_complete_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_complete_request);
+
+static bool blk_mq_hctx_has_pending(struct blk_mq_hw_ctx *hctx)
+{
+	return !list_empty_careful(&hctx->dispatch) ||
+		find_first_bit(hctx->ctx_map, hctx->nr_ctx) < hctx->nr_ctx;
+}
+
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	/*
+	 * Requests the driver bounced last time go first, then everything
+	 * the software queues collected meanwhile.
+	 */
+	if (!list_empty_careful(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	for_each_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		if (!test_and_clear_bit(bit, hctx->ctx_map))
+			continue;
+		ctx = hctx->ctxs[bit];
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, rq->errors);
+	}
+
+	if (list_empty(&rq_list))
+		return;
+
+	spin_lock(&hctx->lock);
+	list_splice(&rq_list, &hctx->dispatch);
+	spin_unlock(&hctx->lock);
+
+	/*
+	 * The driver may have restarted the queue between returning BUSY and
+	 * us parking the leftovers, don't leave them behind.
+	 */
+	smp_mb();
+	if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+		kblockd_schedule_work(q, &hctx->run_work);
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch pending requests of a hardware context
+ * @hctx:	the hardware context
+ * @async:	punt the work to kblockd instead of running it here
+ *
+ * Synchronous runs need process context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (blk_mq_hctx_has_pending(hctx))
+			blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/**
+ * blk_mq_stop_hw_queue - stop dispatching to a hardware context
+ * @hctx:	the hardware context
+ *
+ * Typically called from ->queue_rq when the device is full, right before
+ * returning BLK_MQ_RQ_QUEUE_BUSY.  Requests keep collecting on the
+ * software queues until the driver restarts the context.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+	smp_mb__after_clear_bit();
+	__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_start_hw_queue);
+
+/**
+ * blk_mq_start_stopped_hw_queues - restart stopped hardware contexts
+ * @q:		the queue
+ * @async:	run them from kblockd, required from interrupt context
+ */
+void blk_mq_start_stopped_hw_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_and_clear_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		smp_mb__after_clear_bit();
+		blk_mq_run_hw_queue(hctx, async);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void __blk_mq_insert_request(struct blk_mq_hw_ctx *hctx,
+				    struct blk_mq_ctx *ctx,
+				    struct request *rq, bool at_head)
+{
+	if (at_head)
+		list_add(&rq->queuelist, &ctx->rq_list);
+	else
+		list_add_tail(&rq->queuelist, &ctx->rq_list);
+
+	if (!test_bit(ctx->index_hw, hctx->ctx_map))
+		set_bit(ctx->index_hw, hctx->ctx_map);
+}
+
+/**
+ * blk_mq_insert_request - queue a request on its software queue
+ * @rq:		request from blk_mq_alloc_request()
+ * @at_head:	queue it in front of the other pending requests
+ * @run_queue:	dispatch right away
+ * @async:	dispatch from kblockd rather than from this context
+ */
+void blk_mq_insert_request(struct request *rq, bool at_head, bool run_queue,
+			   bool async)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_ctx *ctx = rq->mq_ctx;
+	struct blk_mq_hw_ctx *hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	spin_lock(&ctx->lock);
+	__blk_mq_insert_request(hctx, ctx, rq, at_head);
+	spin_unlock(&ctx->lock);
+
+	if (run_queue)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_insert_request);
+
+static bool blk_mq_rq_merge_ok(struct request *rq, struct bio *bio)
+{
+	if (!rq_mergeable(rq))
+		return false;
+	if (bio_rw_flagged(bio, BIO_RW_DISCARD) !=
+	    bio_rw_flagged(rq->bio, BIO_RW_DISCARD))
+		return false;
+	if (bio_data_dir(bio) != rq_data_dir(rq))
+		return false;
+	if (rq->rq_disk != bio->bi_bdev->bd_disk || rq->special)
+		return false;
+	if (bio_integrity(bio) != blk_integrity_rq(rq))
+		return false;
+	return true;
+}
+
+/*
+ * Try to append @bio to one of the last requests still waiting on the
+ * software queue.  Called with ctx->lock held.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	const unsigned int ff = bio->bi_rw & REQ_FAILFAST_MASK;
+	int checked = BLK_MQ_MERGE_DEPTH;
+	struct request *rq;
+
+	list_for_each_entry_reverse(rq, &ctx->rq_list, queuelist) {
+		if (!checked--)
+			break;
+		if (!blk_mq_rq_merge_ok(rq, bio))
+			continue;
+		if (blk_rq_pos(rq) + blk_rq_sectors(rq) != bio->bi_sector)
+			continue;
+		if (!ll_back_merge_fn(q, rq, bio))
+			break;
+
+		if ((rq->cmd_flags & REQ_FAILFAST_MASK) != ff)
+			blk_rq_set_mixed_merge(rq);
+
+		rq->biotail->bi_next = bio;
+		rq->biotail = bio;
+		rq->__data_len += bio->bi_size;
+		rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+
+		if (blk_do_io_stat(rq)) {
+			struct hd_struct *part;
+			int cpu;
+
+			cpu = part_stat_lock();
+			part = disk_map_sector_rcu(rq->rq_disk, blk_rq_pos(rq));
+			part_stat_inc(cpu, part, merges[rq_data_dir(rq)]);
+			part_stat_unlock();
+		}
+		return true;
+	}
+	return false;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool is_sync = bio_data_dir(bio) == READ ||
+			     bio_rw_flagged(bio, BIO_RW_SYNCIO) ||
+			     bio_rw_flagged(bio, BIO_RW_UNPLUG);
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int rw_flags;
+
+	if (bio_rw_flagged(bio, BIO_RW_BARRIER) &&
+	    q->next_ordered != QUEUE_ORDERED_TAG) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	ctx = blk_mq_get_ctx(q);
+	if (!bio_rw_flagged(bio, BIO_RW_BARRIER) && !blk_queue_nomerges(q)) {
+		spin_lock(&ctx->lock);
+		if (blk_mq_attempt_merge(q, ctx, bio)) {
+			spin_unlock(&ctx->lock);
+			goto run;
+		}
+		spin_unlock(&ctx->lock);
+	}
+
+	rw_flags = bio_data_dir(bio);
+	if (bio_rw_flagged(bio, BIO_RW_SYNCIO))
+		rw_flags |= REQ_RW_SYNC;
+
+	/* Might sleep for a tag, but can not fail */
+	rq = __blk_mq_alloc_request(q, ctx, rw_flags, GFP_NOIO);
+	init_request_from_bio(rq, bio);
+	rq->cpu = ctx->cpu;
+
+	blk_mq_insert_request(rq, false, false, false);
+run:
+	/*
+	 * Sync I/O is dispatched from here.  Async writes are left to kblockd
+	 * so that the bios following them get a chance to merge.
+	 */
+	blk_mq_run_hw_queue(q->mq_ops->map_queue(q, ctx->cpu), !is_sync);
+	return 0;
+}
+
+static void blk_mq_unplug(struct request_queue *q)
+{
+	blk_mq_run_queues(q, false);
+}
+
+void blk_mq_sync_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	if (!q->queue_hw_ctx)
+		return;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (hctx)
+			cancel_work_sync(&hctx->run_work);
+	}
+}
+
+void blk_mq_free_queue(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	if (q->queue_hw_ctx) {
+		queue_for_each_hw_ctx(q, hctx, i) {
+			if (!hctx)
+				continue;
+			blk_mq_free_tags(hctx->tags);
+			kfree(hctx->ctx_map);
+			kfree(hctx->ctxs);
+			kfree(hctx);
+		}
+		kfree(q->queue_hw_ctx);
+	}
+	kfree(q->mq_map);
+	if (q->queue_ctx)
+		free_percpu(q->queue_ctx);
+}
+
+static struct blk_mq_hw_ctx *blk_mq_alloc_hctx(struct blk_mq_reg *reg,
+					       size_t rq_size)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int node = reg->numa_node;
+
+	hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, node);
+	if (!hctx)
+		return NULL;
+
+	spin_lock_init(&hctx->lock);
+	INIT_LIST_HEAD(&hctx->dispatch);
+	INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+	hctx->numa_node = node;
+	hctx->queue_depth = reg->queue_depth;
+
+	hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *), GFP_KERNEL,
+				  node);
+	hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) * sizeof(long),
+				     GFP_KERNEL, node);
+	hctx->tags = blk_mq_init_tags(reg->queue_depth, rq_size, node);
+	if (!hctx->ctxs || !hctx->ctx_map || !hctx->tags) {
+		blk_mq_free_tags(hctx->tags);
+		kfree(hctx->ctx_map);
+		kfree(hctx->ctxs);
+		kfree(hctx);
+		return NULL;
+	}
+	return hctx;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:		device description: ops, queue count and depth
+ * @driver_data:	stored in every hctx->driver_data
+ *
+ * Description:
+ *    Allocates @reg->nr_hw_queues hardware contexts of @reg->queue_depth
+ *    preallocated requests each, every one followed by @reg->cmd_size
+ *    bytes for the driver (see blk_mq_rq_to_pdu()), and a software
+ *    queue per possible cpu.
+ *
+ *    The returned queue has no elevator and no queue_lock protected
+ *    state; it is torn down with blk_cleanup_queue() as usual.  Returns
+ *    %NULL on failure.
+ **/
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	struct blk_mq_hw_ctx *hctx;
+	size_t rq_size;
+	unsigned int i;
+
+	if (!reg->ops || !reg->ops->queue_rq || !reg->ops->map_queue ||
+	    !reg->nr_hw_queues || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->node = reg->numa_node;
+	q->mq_ops = reg->ops;
+	q->nr_queues = nr_cpu_ids;
+	q->nr_hw_queues = min_t(unsigned int, reg->nr_hw_queues, nr_cpu_ids);
+
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, q->node);
+	q->queue_hw_ctx = kzalloc_node(q->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, q->node);
+	if (!q->queue_ctx || !q->mq_map || !q->queue_hw_ctx)
+		goto fail;
+
+	for_each_possible_cpu(i)
+		q->mq_map[i] = i * q->nr_hw_queues / nr_cpu_ids;
+
+	rq_size = sizeof(struct request) + reg->cmd_size;
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		hctx = blk_mq_alloc_hctx(reg, rq_size);
+		if (!hctx)
+			goto fail;
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->driver_data = driver_data;
+		q->queue_hw_ctx[i] = hctx;
+	}
+
+	for_each_possible_cpu(i) {
+		struct blk_mq_ctx *ctx = __blk_mq_get_ctx(q, i);
+
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+
+		hctx = q->mq_ops->map_queue(q, i);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	/*
+	 * This also sets hw/phys segments, boundary and size
+	 */
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->unplug_fn = blk_mq_unplug;
+	q->softirq_done_fn = reg->ops->complete;
+	q->queue_flags = (1 << QUEUE_FLAG_IO_STAT) | (1 << QUEUE_FLAG_SAME_COMP);
+	q->sg_reserved_size = INT_MAX;
+
+	return q;
+
+fail:
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
@@ -1,6 +1,7 @@
 //#define DEBUG
 #include <linux/spinlock.h>
 #include <linux/blkdev.h>
+#include <linux/blk-mq.h>
 #include <linux/hdreg.h>
 #include <linux/virtio.h>
 #include <linux/virtio_blk.h>
@@ -10,6 +11,10 @@
 
 static int major, index;
 
+static int use_blk_mq = 1;
+module_param(use_blk_mq, bool, 0444);
+MODULE_PARM_DESC(use_blk_mq, "Use the multi-queue block layer when the device allows it");
+
 struct virtio_blk
 {
 	spinlock_t lock;
@@ -41,41 +46,55 @@ struct virtblk_req
 	u8 status;
 };
 
+static int virtblk_result(struct virtblk_req *vbr)
+{
+	switch (vbr->status) {
+	case VIRTIO_BLK_S_OK:
+		return 0;
+	case VIRTIO_BLK_S_UNSUPP:
+		return -ENOTTY;
+	default:
+		return -EIO;
+	}
+}
+
+/* blk-mq completion, on the cpu that submitted the request */
+static void virtblk_request_done(struct request *req)
+{
+	struct virtblk_req *vbr = blk_mq_rq_to_pdu(req);
+
+	blk_mq_end_io(req, virtblk_result(vbr));
+}
+
 static void blk_done(struct virtqueue *vq)
 {
 	struct virtio_blk *vblk = vq->vdev->priv;
+	struct request_queue *q = vblk->disk->queue;
 	struct virtblk_req *vbr;
 	unsigned int len;
 	unsigned long flags;
 
 	spin_lock_irqsave(&vblk->lock, flags);
 	while ((vbr = vblk->vq->vq_ops->get_buf(vblk->vq, &len)) != NULL) {
-		int error;
-
-		switch (vbr->status) {
-		case VIRTIO_BLK_S_OK:
-			error = 0;
-			break;
-		case VIRTIO_BLK_S_UNSUPP:
-			error = -ENOTTY;
-			break;
-		default:
-			error = -EIO;
-			break;
-		}
-
 		if (blk_pc_request(vbr->req)) {
 			vbr->req->resid_len = vbr->in_hdr.residual;
 			vbr->req->sense_len = vbr->in_hdr.sense_len;
 			vbr->req->errors = vbr->in_hdr.errors;
 		}
 
-		__blk_end_request_all(vbr->req, error);
 		list_del(&vbr->list);
+		if (q->mq_ops) {
+			blk_mq_complete_request(vbr->req);
+			continue;
+		}
+		__blk_end_request_all(vbr->req, virtblk_result(vbr));
 		mempool_free(vbr, vblk->pool);
 	}
 	/* In case queue is stopped waiting for more buffers. */
-	blk_start_queue(vblk->disk->queue);
+	if (q->mq_ops)
+		blk_mq_start_stopped_hw_queues(q, true);
+	else
+		blk_start_queue(q);
 	spin_unlock_irqrestore(&vblk->lock, flags);
 }
 
@@ -85,10 +104,14 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	unsigned long num, out = 0, in = 0;
 	struct virtblk_req *vbr;
 
-	vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
-	if (!vbr)
-		/* When another request finishes we'll try again. */
-		return false;
+	if (q->mq_ops)
+		vbr = blk_mq_rq_to_pdu(req);
+	else {
+		vbr = mempool_alloc(vblk->pool, GFP_ATOMIC);
+		if (!vbr)
+			/* When another request finishes we'll try again. */
+			return false;
+	}
 
 	vbr->req = req;
 	switch (req->cmd_type) {
@@ -151,7 +174,8 @@ static bool do_req(struct request_queue *q, struct virtio_blk *vblk,
 	}
 
 	if (vblk->vq->vq_ops->add_buf(vblk->vq, vblk->sg, out, in, vbr) < 0) {
-		mempool_free(vbr, vblk->pool);
+		if (!q->mq_ops)
+			mempool_free(vbr, vblk->pool);
 		return false;
 	}
 
@@ -182,6 +206,40 @@ static void do_virtblk_request(struct request_queue *q)
 		vblk->vq->vq_ops->kick(vblk->vq);
 }
 
+static int virtblk_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *req)
+{
+	struct virtio_blk *vblk = hctx->driver_data;
+
+	BUG_ON(req->nr_phys_segments + 2 > vblk->sg_elems);
+
+	spin_lock_irq(&vblk->lock);
+	if (!do_req(hctx->queue, vblk, req)) {
+		/* blk_done restarts us once something finishes */
+		blk_mq_stop_hw_queue(hctx);
+		spin_unlock_irq(&vblk->lock);
+		return BLK_MQ_RQ_QUEUE_BUSY;
+	}
+	vblk->vq->vq_ops->kick(vblk->vq);
+	spin_unlock_irq(&vblk->lock);
+
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops virtio_mq_ops = {
+	.queue_rq	= virtblk_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+	.complete	= virtblk_request_done,
+};
+
+/* One virtqueue, so one hardware queue fed by all the cpus */
+static struct blk_mq_reg virtio_mq_reg = {
+	.ops		= &virtio_mq_ops,
+	.nr_hw_queues	= 1,
+	.queue_depth	= 64,
+	.cmd_size	= sizeof(struct virtblk_req),
+	.numa_node	= -1,
+};
+
 static void virtblk_prepare_flush(struct request_queue *q, struct request *req)
 {
 	req->cmd_type = REQ_TYPE_LINUX_BLOCK;
@@ -293,7 +351,15 @@ static int __devinit virtblk_probe(struct virtio_device *vdev)
 		goto out_mempool;
 	}
 
-	vblk->disk->queue = blk_init_queue(do_virtblk_request, &vblk->lock);
+	/*
+	 * Cache flushes need the barrier sequencing of the elevator path,
+	 * devices offering them stay on the request_fn queue.
+	 */
+	if (use_blk_mq && !virtio_has_feature(vdev, VIRTIO_BLK_F_FLUSH))
+		vblk->disk->queue = blk_mq_init_queue(&virtio_mq_reg, vblk);
+	else
+		vblk->disk->queue = blk_init_queue(do_virtblk_request,
+						   &vblk->lock);
 	if (!vblk->disk->queue) {
 		err = -ENOMEM;
 		goto out_put_disk;
@@ -0,0 +1,657 @@
+/*
+ * Compressed RAM block device
+ *
+ * Creates RAM based block devices called /dev/zramX (X = 0, 1, ...).
+ * Pages written to these disks are compressed with LZO and stored in a
+ * zspool, so memory is only used for data actually written, at roughly
+ * half to a third of its size for typical swap and /tmp contents.  Pages
+ * filled with a single repeated word (most often zero) take no memory at
+ * all, and discard requests give the memory of the discarded pages back.
+ *
+ * Typical uses are fast swap on hosts with little memory and /tmp or
+ * /var/tmp: in both cases the device is effectively a compressed part of
+ * RAM that is only paid for while in use.
+ *
+ * Derived from drivers/block/brd.c.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#define KMSG_COMPONENT "zram"
+#define pr_fmt(fmt) KMSG_COMPONENT ": " fmt
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/bio.h>
+#include <linux/bitops.h>
+#include <linux/blkdev.h>
+#include <linux/buffer_head.h>
+#include <linux/device.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/lzo.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "zram_drv.h"
+
+/* Globals */
+static int zram_major;
+struct zram *zram_devices;
+
+/* Module params (documentation at end) */
+unsigned int zram_num_devices;
+
+static void zram_stat64_add(struct zram *zram, u64 *v, u64 inc)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v + inc;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static void zram_stat64_sub(struct zram *zram, u64 *v, u64 dec)
+{
+	spin_lock(&zram->stat64_lock);
+	*v = *v - dec;
+	spin_unlock(&zram->stat64_lock);
+}
+
+static void zram_stat64_inc(struct zram *zram, u64 *v)
+{
+	zram_stat64_add(zram, v, 1);
+}
+
+static int zram_test_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	return zram->table[index].flags & BIT(flag);
+}
+
+static void zram_set_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	zram->table[index].flags |= BIT(flag);
+}
+
+static void zram_clear_flag(struct zram *zram, u32 index,
+			enum zram_pageflags flag)
+{
+	zram->table[index].flags &= ~BIT(flag);
+}
+
+static bool page_same_filled(void *ptr, unsigned long *element)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page) - 1; pos++) {
+		if (page[pos] != page[pos + 1])
+			return false;
+	}
+
+	*element = page[0];
+	return true;
+}
+
+static void zram_fill_page(void *ptr, unsigned long value)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	if (likely(value == 0)) {
+		memset(ptr, 0, PAGE_SIZE);
+		return;
+	}
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++)
+		page[pos] = value;
+}
+
+/* Caller must hold zram->lock for writing */
+static void zram_free_page(struct zram *zram, u32 index)
+{
+	struct table *t = &zram->table[index];
+
+	if (zram_test_flag(zram, index, ZRAM_SAME)) {
+		zram_clear_flag(zram, index, ZRAM_SAME);
+		t->element = 0;
+		zram->stats.pages_same--;
+		return;
+	}
+
+	/* never written to, or discarded */
+	if (!t->page)
+		return;
+
+	if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		__free_page(t->page);
+		zram_clear_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram->stats.pages_expand--;
+		zram_stat64_sub(zram, &zram->stats.compr_size, PAGE_SIZE);
+	} else {
+		zs_free(zram->mem_pool, t->size, t->page, t->offset);
+		if (t->size <= PAGE_SIZE / 2)
+			zram->stats.good_compress--;
+		zram_stat64_sub(zram, &zram->stats.compr_size, t->size);
+	}
+
+	zram->stats.pages_stored--;
+	t->page = NULL;
+	t->offset = 0;
+	t->size = 0;
+}
+
+static int zram_read(struct zram *zram, struct bio_vec *bvec, u32 index)
+{
+	struct table *t = &zram->table[index];
+	unsigned char *user_mem, *cmem;
+	size_t clen = PAGE_SIZE;
+	int ret = LZO_E_OK;
+
+	user_mem = kmap_atomic(bvec->bv_page, KM_USER0);
+
+	if (zram_test_flag(zram, index, ZRAM_SAME) || !t->page) {
+		/* element is 0 for pages never written to */
+		zram_fill_page(user_mem, t->element);
+	} else if (unlikely(zram_test_flag(zram, index, ZRAM_UNCOMPRESSED))) {
+		cmem = kmap_atomic(t->page, KM_USER1);
+		copy_page(user_mem, cmem);
+		kunmap_atomic(cmem, KM_USER1);
+	} else {
+		cmem = page_address(t->page) + t->offset;
+		ret = lzo1x_decompress_safe(cmem, t->size, user_mem, &clen);
+	}
+
+	kunmap_atomic(user_mem, KM_USER0);
+
+	/* Should NEVER happen. Return bio error if it does. */
+	if (unlikely(ret != LZO_E_OK || clen != PAGE_SIZE)) {
+		pr_err("Decompression failed! err=%d, page=%u\n", ret, index);
+		zram_stat64_inc(zram, &zram->stats.failed_reads);
+		return -EIO;
+	}
+
+	flush_dcache_page(bvec->bv_page);
+	return 0;
+}
+
+/* Caller must hold zram->lock for writing */
+static int zram_write(struct zram *zram, struct bio_vec *bvec, u32 index)
+{
+	struct table *t = &zram->table[index];
+	unsigned char *user_mem, *cmem;
+	unsigned long element;
+	struct page *page;
+	size_t clen;
+	u32 offset;
+	int ret;
+
+	/*
+	 * System overwrites unused sectors. Free memory associated
+	 * with this sector now.
+	 */
+	zram_free_page(zram, index);
+
+	user_mem = kmap_atomic(bvec->bv_page, KM_USER0);
+	if (page_same_filled(user_mem, &element)) {
+		kunmap_atomic(user_mem, KM_USER0);
+		t->element = element;
+		zram_set_flag(zram, index, ZRAM_SAME);
+		zram->stats.pages_same++;
+		return 0;
+	}
+
+	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, zram->compress_buffer,
+			       &clen, zram->compress_workmem);
+	kunmap_atomic(user_mem, KM_USER0);
+
+	if (unlikely(ret != LZO_E_OK)) {
+		pr_err("Compression failed! err=%d\n", ret);
+		zram_stat64_inc(zram, &zram->stats.failed_writes);
+		return -EIO;
+	}
+
+	/*
+	 * Page is incompressible, or the pool could not grow: store it
+	 * as-is in a page of its own.
+	 */
+	if (unlikely(clen > max_zpage_size ||
+		     zs_malloc(zram->mem_pool, clen, &page, &offset))) {
+		page = alloc_page(GFP_NOIO | __GFP_HIGHMEM | __GFP_NOWARN);
+		if (unlikely(!page)) {
+			pr_info("Error allocating memory for incompressible "
+				"page: %u, size=%zu\n", index, clen);
+			zram_stat64_inc(zram, &zram->stats.failed_writes);
+			return -ENOMEM;
+		}
+
+		user_mem = kmap_atomic(bvec->bv_page, KM_USER0);
+		cmem = kmap_atomic(page, KM_USER1);
+		copy_page(cmem, user_mem);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(user_mem, KM_USER0);
+
+		t->page = page;
+		t->offset = 0;
+		t->size = 0;
+		zram_set_flag(zram, index, ZRAM_UNCOMPRESSED);
+		zram->stats.pages_expand++;
+		zram->stats.pages_stored++;
+		zram_stat64_add(zram, &zram->stats.compr_size, PAGE_SIZE);
+		return 0;
+	}
+
+	memcpy(page_address(page) + offset, zram->compress_buffer, clen);
+
+	t->page = page;
+	t->offset = offset;
+	t->size = clen;
+
+	/* Update stats */
+	zram->stats.pages_stored++;
+	if (clen <= PAGE_SIZE / 2)
+		zram->stats.good_compress++;
+	zram_stat64_add(zram, &zram->stats.compr_size, clen);
+
+	return 0;
+}
+
+/*
+ * Free the memory of all pages entirely covered by a discard request.
+ * Partially covered pages at either end keep their contents.
+ */
+static void zram_discard(struct zram *zram, struct bio *bio)
+{
+	sector_t sector = bio->bi_sector;
+	unsigned int nr_sects = bio->bi_size >> SECTOR_SHIFT;
+	unsigned int misalign = sector & (SECTORS_PER_PAGE - 1);
+	u32 index;
+
+	if (misalign) {
+		misalign = SECTORS_PER_PAGE - misalign;
+		if (nr_sects <= misalign)
+			return;
+		sector += misalign;
+		nr_sects -= misalign;
+	}
+
+	index = sector >> SECTORS_PER_PAGE_SHIFT;
+	down_write(&zram->lock);
+	while (nr_sects >= SECTORS_PER_PAGE) {
+		if (zram->table[index].page ||
+		    zram_test_flag(zram, index, ZRAM_SAME)) {
+			zram_free_page(zram, index);
+			zram_stat64_inc(zram, &zram->stats.notify_free);
+		}
+		index++;
+		nr_sects -= SECTORS_PER_PAGE;
+	}
+	up_write(&zram->lock);
+}
+
+static void __zram_make_request(struct zram *zram, struct bio *bio, int rw)
+{
+	struct bio_vec *bvec;
+	u32 index;
+	int i, ret = 0;
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	if (rw == READ) {
+		zram_stat64_inc(zram, &zram->stats.num_reads);
+		down_read(&zram->lock);
+	} else {
+		zram_stat64_inc(zram, &zram->stats.num_writes);
+		down_write(&zram->lock);
+	}
+
+	bio_for_each_segment(bvec, bio, i) {
+		/* the logical block size keeps segments page sized */
+		if (unlikely(bvec->bv_len != PAGE_SIZE || bvec->bv_offset)) {
+			zram_stat64_inc(zram, &zram->stats.invalid_io);
+			ret = -EINVAL;
+			break;
+		}
+
+		if (rw == READ)
+			ret = zram_read(zram, bvec, index);
+		else
+			ret = zram_write(zram, bvec, index);
+		if (ret)
+			break;
+
+		index++;
+	}
+
+	if (rw == READ)
+		up_read(&zram->lock);
+	else
+		up_write(&zram->lock);
+
+	bio_endio(bio, ret);
+}
+
+/*
+ * Check if request is within bounds and aligned on zram logical blocks.
+ * Discards only need to be within bounds.
+ */
+static inline int valid_io_request(struct zram *zram, struct bio *bio)
+{
+	u64 end = ((u64)bio->bi_sector << SECTOR_SHIFT) + bio->bi_size;
+
+	if (unlikely(end > zram->disksize))
+		return 0;
+
+	if (bio_rw_flagged(bio, BIO_RW_DISCARD))
+		return 1;
+
+	if (unlikely(bio->bi_sector & (SECTORS_PER_PAGE - 1)) ||
+	    unlikely(bio->bi_size & (PAGE_SIZE - 1)))
+		return 0;
+
+	/* I/O request is valid */
+	return 1;
+}
+
+/*
+ * Handler function for all zram I/O requests.
+ */
+static int zram_make_request(struct request_queue *queue, struct bio *bio)
+{
+	struct zram *zram = queue->queuedata;
+
+	down_read(&zram->init_lock);
+	if (unlikely(!zram->init_done))
+		goto error;
+
+	if (!valid_io_request(zram, bio)) {
+		zram_stat64_inc(zram, &zram->stats.invalid_io);
+		goto error;
+	}
+
+	if (bio_rw_flagged(bio, BIO_RW_DISCARD)) {
+		zram_discard(zram, bio);
+		bio_endio(bio, 0);
+	} else {
+		__zram_make_request(zram, bio, bio_data_dir(bio));
+	}
+	up_read(&zram->init_lock);
+
+	return 0;
+
+error:
+	up_read(&zram->init_lock);
+	bio_io_error(bio);
+	return 0;
+}
+
+/* Caller must hold zram->init_lock for writing */
+void __zram_reset_device(struct zram *zram)
+{
+	size_t index;
+
+	if (!zram->init_done)
+		return;
+
+	zram->init_done = 0;
+
+	/* Free various per-device buffers */
+	kfree(zram->compress_workmem);
+	free_pages((unsigned long)zram->compress_buffer, 1);
+
+	zram->compress_workmem = NULL;
+	zram->compress_buffer = NULL;
+
+	/* Free all pages that are still in this zram device */
+	for (index = 0; index < zram->disksize >> PAGE_SHIFT; index++)
+		zram_free_page(zram, index);
+
+	vfree(zram->table);
+	zram->table = NULL;
+
+	zs_destroy_pool(zram->mem_pool);
+	zram->mem_pool = NULL;
+
+	/* Reset stats */
+	memset(&zram->stats, 0, sizeof(zram->stats));
+
+	zram->disksize = 0;
+	set_capacity(zram->disk, 0);
+}
+
+/*
+ * Allocate the metadata of a device whose disksize has just been set.
+ * Caller must hold zram->init_lock for writing.
+ */
+int zram_init_device(struct zram *zram)
+{
+	size_t num_pages;
+	int ret;
+
+	zram->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	if (!zram->compress_workmem) {
+		pr_err("Error allocating compressor working memory!\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	zram->compress_buffer =
+		(void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO, 1);
+	if (!zram->compress_buffer) {
+		pr_err("Error allocating compressor buffer space\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	num_pages = zram->disksize >> PAGE_SHIFT;
+	zram->table = vmalloc(num_pages * sizeof(*zram->table));
+	if (!zram->table) {
+		pr_err("Error allocating zram address table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(zram->table, 0, num_pages * sizeof(*zram->table));
+
+	zram->mem_pool = zs_create_pool(GFP_NOIO);
+	if (!zram->mem_pool) {
+		pr_err("Error creating memory pool\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	set_capacity(zram->disk, zram->disksize >> SECTOR_SHIFT);
+	zram->init_done = 1;
+
+	pr_debug("Initialization done!\n");
+	return 0;
+
+fail:
+	vfree(zram->table);
+	zram->table = NULL;
+	kfree(zram->compress_workmem);
+	zram->compress_workmem = NULL;
+	free_pages((unsigned long)zram->compress_buffer, 1);
+	zram->compress_buffer = NULL;
+	zram->disksize = 0;
+	pr_err("Initialization failed: err=%d\n", ret);
+	return ret;
+}
+
+static const struct block_device_operations zram_devops = {
+	.owner = THIS_MODULE
+};
+
+static int create_device(struct zram *zram, int device_id)
+{
+	int ret = 0;
+
+	init_rwsem(&zram->lock);
+	init_rwsem(&zram->init_lock);
+	spin_lock_init(&zram->stat64_lock);
+
+	zram->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->queue) {
+		pr_err("Error allocating disk queue for device %d\n",
+			device_id);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	blk_queue_make_request(zram->queue, zram_make_request);
+	blk_queue_ordered(zram->queue, QUEUE_ORDERED_TAG, NULL);
+	blk_queue_bounce_limit(zram->queue, BLK_BOUNCE_ANY);
+	zram->queue->queuedata = zram;
+
+	 /* gendisk structure */
+	zram->disk = alloc_disk(1);
+	if (!zram->disk) {
+		pr_warning("Error allocating disk structure for device %d\n",
+			device_id);
+		ret = -ENOMEM;
+		goto out_free_queue;
+	}
+
+	zram->disk->major = zram_major;
+	zram->disk->first_minor = device_id;
+	zram->disk->fops = &zram_devops;
+	zram->disk->queue = zram->queue;
+	zram->disk->private_data = zram;
+	snprintf(zram->disk->disk_name, 16, "zram%d", device_id);
+
+	/* Actual capacity set using sysfs (/sys/block/zram<id>/disksize) */
+	set_capacity(zram->disk, 0);
+
+	/*
+	 * To ensure that we always get PAGE_SIZE aligned
+	 * and n*PAGE_SIZED sized I/O requests.
+	 */
+	blk_queue_physical_block_size(zram->disk->queue, PAGE_SIZE);
+	blk_queue_logical_block_size(zram->disk->queue, PAGE_SIZE);
+	blk_queue_io_min(zram->disk->queue, PAGE_SIZE);
+	blk_queue_io_opt(zram->disk->queue, PAGE_SIZE);
+
+	/* no seek penalty: swap treats it as SSD and uses discard */
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, zram->disk->queue);
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, zram->disk->queue);
+	blk_queue_max_discard_sectors(zram->disk->queue, UINT_MAX);
+
+	add_disk(zram->disk);
+
+#ifdef CONFIG_SYSFS
+	ret = sysfs_create_group(&disk_to_dev(zram->disk)->kobj,
+				&zram_disk_attr_group);
+	if (ret < 0) {
+		pr_warning("Error creating sysfs group");
+		goto out_free_disk;
+	}
+#endif
+
+	zram->init_done = 0;
+	return 0;
+
+#ifdef CONFIG_SYSFS
+out_free_disk:
+	del_gendisk(zram->disk);
+	put_disk(zram->disk);
+#endif
+out_free_queue:
+	blk_cleanup_queue(zram->queue);
+out:
+	return ret;
+}
+
+static void destroy_device(struct zram *zram)
+{
+#ifdef CONFIG_SYSFS
+	sysfs_remove_group(&disk_to_dev(zram->disk)->kobj,
+			&zram_disk_attr_group);
+#endif
+
+	if (zram->disk) {
+		del_gendisk(zram->disk);
+		put_disk(zram->disk);
+	}
+
+	if (zram->queue)
+		blk_cleanup_queue(zram->queue);
+}
+
+static int __init zram_init(void)
+{
+	int ret, dev_id;
+
+	if (zram_num_devices > 32) {
+		pr_warning("Invalid value for num_devices: %u\n",
+				zram_num_devices);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major <= 0) {
+		pr_warning("Unable to get major number\n");
+		ret = -EBUSY;
+		goto out;
+	}
+
+	if (!zram_num_devices) {
+		pr_info("num_devices not specified. Using default: 1\n");
+		zram_num_devices = default_num_devices;
+	}
+
+	/* Allocate the device array and initialize each one */
+	pr_info("Creating %u devices ...\n", zram_num_devices);
+	zram_devices = kzalloc(zram_num_devices * sizeof(struct zram),
+				GFP_KERNEL);
+	if (!zram_devices) {
+		ret = -ENOMEM;
+		goto unregister;
+	}
+
+	for (dev_id = 0; dev_id < zram_num_devices; dev_id++) {
+		ret = create_device(&zram_devices[dev_id], dev_id);
+		if (ret)
+			goto free_devices;
+	}
+
+	return 0;
+
+free_devices:
+	while (dev_id)
+		destroy_device(&zram_devices[--dev_id]);
+	kfree(zram_devices);
+unregister:
+	unregister_blkdev(zram_major, "zram");
+out:
+	return ret;
+}
+
+static void __exit zram_exit(void)
+{
+	int i;
+	struct zram *zram;
+
+	for (i = 0; i < zram_num_devices; i++) {
+		zram = &zram_devices[i];
+
+		down_write(&zram->init_lock);
+		__zram_reset_device(zram);
+		up_write(&zram->init_lock);
+		destroy_device(zram);
+	}
+
+	unregister_blkdev(zram_major, "zram");
+
+	kfree(zram_devices);
+	pr_debug("Cleanup done!\n");
+}
+
+module_param_named(num_devices, zram_num_devices, uint, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+
+module_init(zram_init);
+module_exit(zram_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM Block Device");
@@ -0,0 +1,102 @@
+/*
+ * Compressed RAM block device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#ifndef _ZRAM_DRV_H_
+#define _ZRAM_DRV_H_
+
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <linux/genhd.h>
+
+#include "zspool.h"
+
+/* Default number of zram devices, if not given as a module parameter */
+static const unsigned default_num_devices = 1;
+
+/*
+ * Pages that compress to size greater than this are stored
+ * uncompressed in memory.
+ */
+static const size_t max_zpage_size = ZS_MAX_ALLOC_SIZE;
+
+#define SECTOR_SHIFT		9
+#define SECTOR_SIZE		(1 << SECTOR_SHIFT)
+#define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define SECTORS_PER_PAGE	(1 << SECTORS_PER_PAGE_SHIFT)
+
+/* Flags for zram pages (table[page_no].flags) */
+enum zram_pageflags {
+	/* Page is filled with one repeated word: table[].element holds it */
+	ZRAM_SAME,
+	/* Page is stored uncompressed in a page of its own */
+	ZRAM_UNCOMPRESSED,
+
+	__NR_ZRAM_PAGEFLAGS,
+};
+
+/*
+ * One entry per PAGE_SIZE block of the device.  An entry with neither
+ * a page nor ZRAM_SAME set has never been written, or was discarded,
+ * and reads back as zeroes.
+ */
+struct table {
+	union {
+		struct page *page;	/* zspage or uncompressed page */
+		unsigned long element;	/* ZRAM_SAME fill value */
+	};
+	u32 offset;			/* object offset within the zspage */
+	u16 size;			/* compressed size */
+	u8 flags;
+} __attribute__((aligned(4)));
+
+struct zram_stats {
+	u64 compr_size;		/* compressed size of pages stored */
+	u64 num_reads;		/* failed + successful */
+	u64 num_writes;		/* --do-- */
+	u64 failed_reads;	/* should NEVER! happen */
+	u64 failed_writes;	/* can happen when memory is too low */
+	u64 invalid_io;		/* non-page-aligned I/O requests */
+	u64 notify_free;	/* pages freed by discard */
+	u32 pages_same;		/* same-filled pages, no memory allocated */
+	u32 pages_stored;	/* other pages holding data */
+	u32 good_compress;	/* no. of pages with compression ratio <= 50% */
+	u32 pages_expand;	/* no. of pages stored uncompressed */
+};
+
+struct zram {
+	struct zs_pool *mem_pool;
+	void *compress_workmem;
+	void *compress_buffer;
+	struct table *table;
+	spinlock_t stat64_lock;	/* protect 64-bit stats */
+	struct rw_semaphore lock; /* reads share it, writes and discards
+				   * are serialized: they use the single
+				   * compression buffer */
+	struct request_queue *queue;
+	struct gendisk *disk;
+	int init_done;
+	/* Prevent concurrent execution of device init, reset and R/W request */
+	struct rw_semaphore init_lock;
+	/*
+	 * This is the limit on amount of *uncompressed* worth of data
+	 * we can store in a disk.
+	 */
+	u64 disksize;	/* bytes */
+
+	struct zram_stats stats;
+};
+
+extern struct zram *zram_devices;
+extern unsigned int zram_num_devices;
+
+#ifdef CONFIG_SYSFS
+extern struct attribute_group zram_disk_attr_group;
+#endif
+
+extern int zram_init_device(struct zram *zram);
+extern void __zram_reset_device(struct zram *zram);
+
+#endif
@@ -0,0 +1,243 @@
+/*
+ * zspool - size-class allocator for compressed pages
+ *
+ * Compressed pages come in every size from a few bytes up to a page, so
+ * neither kmalloc (power-of-two rounding wastes a quarter of the memory
+ * on average) nor whole pages are a good fit.  zspool keeps one class per
+ * ZS_ALIGN bytes of object size.  Each class carves objects out of
+ * "zspages": blocks of 1, 2 or 4 physically contiguous pages, whichever
+ * wastes the least at the end for that object size.  Free objects of a
+ * zspage are chained through their first word, and zspages that still
+ * have free objects sit on their class's partial list, so allocation and
+ * freeing are O(1) under a per-class spinlock.  A zspage is returned to
+ * the page allocator as soon as its last object is freed.
+ *
+ * The metadata of a zspage lives in the struct page of its first page:
+ *	page->private	number of objects in use
+ *	page->freelist	first free object, NULL if the zspage is full
+ *	page->lru	link on the class's partial list
+ *
+ * Objects are addressed by (first page, byte offset) and are always in
+ * lowmem, so they can be reached through page_address().
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/list.h>
+
+#include "zspool.h"
+
+#define ZS_MAX_ORDER		2
+#define ZS_NR_CLASSES		\
+	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) / ZS_ALIGN + 1)
+
+struct size_class {
+	spinlock_t lock;
+	struct list_head partial;	/* zspages with free objects */
+	unsigned int size;		/* object size */
+	unsigned int order;		/* zspage order */
+	unsigned int objs_per_zspage;
+};
+
+struct zs_pool {
+	struct size_class classes[ZS_NR_CLASSES];
+	gfp_t flags;
+	atomic_long_t pages_allocated;
+};
+
+static unsigned int size_to_class(size_t size)
+{
+	if (size < ZS_MIN_ALLOC_SIZE)
+		size = ZS_MIN_ALLOC_SIZE;
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_ALIGN);
+}
+
+/*
+ * Pick the zspage order that wastes the smallest fraction of its memory
+ * on the tail that is too short for one more object.
+ */
+static unsigned int class_order(unsigned int size)
+{
+	unsigned int order, best_order = 0, best_usedpc = 0;
+
+	for (order = 0; order <= ZS_MAX_ORDER; order++) {
+		unsigned long zspage_size = PAGE_SIZE << order;
+		unsigned int usedpc;
+
+		usedpc = (zspage_size - zspage_size % size) * 100 / zspage_size;
+		if (usedpc > best_usedpc) {
+			best_usedpc = usedpc;
+			best_order = order;
+		}
+	}
+	return best_order;
+}
+
+static struct page *alloc_zspage(struct size_class *class, gfp_t flags)
+{
+	struct page *page;
+	void *obj, *next;
+	unsigned int i;
+
+	if (class->order)
+		flags |= __GFP_NORETRY;
+	page = alloc_pages(flags, class->order);
+	if (!page)
+		return NULL;
+
+	/* chain all objects on the free list */
+	obj = page_address(page);
+	for (i = 1; i < class->objs_per_zspage; i++) {
+		next = obj + class->size;
+		*(void **)obj = next;
+		obj = next;
+	}
+	*(void **)obj = NULL;
+
+	page->freelist = page_address(page);
+	set_page_private(page, 0);
+	INIT_LIST_HEAD(&page->lru);
+	return page;
+}
+
+static void free_zspage(struct size_class *class, struct page *page)
+{
+	page->freelist = NULL;
+	__free_pages(page, class->order);
+}
+
+/**
+ * zs_create_pool - create an empty pool
+ * @flags: allocation flags for the pages backing the pool
+ *
+ * __GFP_HIGHMEM is ignored: objects must be directly addressable.
+ */
+struct zs_pool *zs_create_pool(gfp_t flags)
+{
+	struct zs_pool *pool;
+	unsigned int i;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	for (i = 0; i < ZS_NR_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_ALIGN;
+		class->order = class_order(class->size);
+		class->objs_per_zspage = (PAGE_SIZE << class->order) /
+					 class->size;
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+	}
+
+	pool->flags = (flags & ~__GFP_HIGHMEM) | __GFP_NOWARN;
+	atomic_long_set(&pool->pages_allocated, 0);
+	return pool;
+}
+
+/**
+ * zs_destroy_pool - free an empty pool
+ * @pool: pool to destroy
+ *
+ * All objects must have been freed with zs_free() beforehand.
+ */
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < ZS_NR_CLASSES; i++)
+		WARN_ON(!list_empty(&pool->classes[i].partial));
+	WARN_ON(atomic_long_read(&pool->pages_allocated));
+	kfree(pool);
+}
+
+/**
+ * zs_malloc - allocate an object from the pool
+ * @pool: pool to allocate from
+ * @size: object size, at most ZS_MAX_ALLOC_SIZE
+ * @page: returns the first page of the zspage holding the object
+ * @offset: returns the byte offset of the object from @page
+ *
+ * Returns 0 on success, -ENOMEM if no zspage could be allocated.
+ */
+int zs_malloc(struct zs_pool *pool, size_t size,
+		struct page **page, u32 *offset)
+{
+	struct size_class *class;
+	struct page *zspage;
+	void *obj;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return -EINVAL;
+
+	class = &pool->classes[size_to_class(size)];
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+		zspage = alloc_zspage(class, pool->flags);
+		if (!zspage)
+			return -ENOMEM;
+		atomic_long_add(1 << class->order, &pool->pages_allocated);
+		spin_lock(&class->lock);
+		list_add(&zspage->lru, &class->partial);
+	}
+
+	zspage = list_first_entry(&class->partial, struct page, lru);
+	obj = zspage->freelist;
+	zspage->freelist = *(void **)obj;
+	set_page_private(zspage, page_private(zspage) + 1);
+	if (!zspage->freelist)
+		list_del_init(&zspage->lru);
+	spin_unlock(&class->lock);
+
+	*page = zspage;
+	*offset = obj - page_address(zspage);
+	return 0;
+}
+
+/**
+ * zs_free - return an object to the pool
+ * @pool: pool the object was allocated from
+ * @size: size passed to zs_malloc()
+ * @page: first page of the object's zspage, as returned by zs_malloc()
+ * @offset: object offset, as returned by zs_malloc()
+ */
+void zs_free(struct zs_pool *pool, size_t size,
+		struct page *page, u32 offset)
+{
+	struct size_class *class = &pool->classes[size_to_class(size)];
+	void *obj = page_address(page) + offset;
+	bool empty;
+
+	spin_lock(&class->lock);
+	*(void **)obj = page->freelist;
+	if (!page->freelist)
+		list_add(&page->lru, &class->partial);
+	page->freelist = obj;
+	set_page_private(page, page_private(page) - 1);
+	empty = !page_private(page);
+	if (empty)
+		list_del(&page->lru);
+	spin_unlock(&class->lock);
+
+	if (empty) {
+		free_zspage(class, page);
+		atomic_long_sub(1 << class->order, &pool->pages_allocated);
+	}
+}
+
+/**
+ * zs_get_total_size_bytes - memory used by the pool
+ * @pool: pool to query
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_long_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
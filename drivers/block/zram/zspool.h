@@ -0,0 +1,33 @@
+/*
+ * zspool - size-class allocator for compressed pages
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#ifndef _ZSPOOL_H_
+#define _ZSPOOL_H_
+
+#include <linux/types.h>
+
+/*
+ * Objects are handed out from size classes ZS_ALIGN bytes apart.  Objects
+ * larger than ZS_MAX_ALLOC_SIZE are not supported: the caller is better
+ * off storing such data in a page of its own.
+ */
+#define ZS_ALIGN		16
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	(PAGE_SIZE / 4 * 3)
+
+struct zs_pool;
+
+struct zs_pool *zs_create_pool(gfp_t flags);
+void zs_destroy_pool(struct zs_pool *pool);
+
+int zs_malloc(struct zs_pool *pool, size_t size,
+		struct page **page, u32 *offset);
+void zs_free(struct zs_pool *pool, size_t size,
+		struct page *page, u32 offset);
+
+u64 zs_get_total_size_bytes(struct zs_pool *pool);
+
+#endif
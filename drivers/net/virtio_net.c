@@ -63,6 +63,9 @@ struct virtnet_info
 	/* Work struct for refilling if we run low on memory. */
 	struct delayed_work refill;
 
+	/* Reaps sent skbs when the send queue interrupt fires. */
+	struct tasklet_struct tx_tasklet;
+
 	/* Chain pages by the private ptr. */
 	struct page *pages;
 };
@@ -114,8 +117,8 @@ static void skb_xmit_done(struct virtqueue *svq)
 	/* Suppress further interrupts. */
 	svq->vq_ops->disable_cb(svq);
 
-	/* We were probably waiting for more output buffers. */
-	netif_wake_queue(vi->dev);
+	/* Reap under the xmit lock, byte queue limits may be waiting. */
+	tasklet_schedule(&vi->tx_tasklet);
 }
 
 static void receive_skb(struct net_device *dev, struct sk_buff *skb,
@@ -455,22 +458,40 @@ again:
 	return received;
 }
 
+/* Caller must hold the xmit lock. */
 static unsigned int free_old_xmit_skbs(struct virtnet_info *vi)
 {
 	struct sk_buff *skb;
 	unsigned int len, tot_sgs = 0;
+	unsigned int bytes = 0, pkts = 0;
 
 	while ((skb = vi->svq->vq_ops->get_buf(vi->svq, &len)) != NULL) {
 		pr_debug("Sent skb %p\n", skb);
 		__skb_unlink(skb, &vi->send);
 		vi->dev->stats.tx_bytes += skb->len;
 		vi->dev->stats.tx_packets++;
+		bytes += skb->len;
+		pkts++;
 		tot_sgs += skb_vnet_hdr(skb)->num_sg;
 		dev_kfree_skb_any(skb);
 	}
+	netdev_completed_queue(vi->dev, pkts, bytes);
 	return tot_sgs;
 }
 
+static void xmit_tasklet(unsigned long data)
+{
+	struct virtnet_info *vi = (struct virtnet_info *)data;
+	struct netdev_queue *txq = netdev_get_tx_queue(vi->dev, 0);
+
+	__netif_tx_lock(txq, smp_processor_id());
+	free_old_xmit_skbs(vi);
+	__netif_tx_unlock(txq);
+
+	/* We were probably waiting for more output buffers. */
+	netif_wake_queue(vi->dev);
+}
+
 static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 {
 	struct scatterlist sg[2+MAX_SKB_FRAGS];
@@ -548,6 +569,7 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 		kfree_skb(skb);
 		return NETDEV_TX_OK;
 	}
+	netdev_sent_queue(dev, skb->len);
 	vi->svq->vq_ops->kick(vi->svq);
 
 	/*
@@ -575,6 +597,11 @@ static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 				vi->svq->vq_ops->disable_cb(vi->svq);
 			}
 		}
+	} else if (netif_xmit_stopped(netdev_get_tx_queue(dev, 0))) {
+		/* Stopped by byte queue limits: only reaping restarts us,
+		 * so ask for the interrupt.  Reap now if we'd miss it. */
+		if (unlikely(!vi->svq->vq_ops->enable_cb(vi->svq)))
+			free_old_xmit_skbs(vi);
 	}
 
 	return NETDEV_TX_OK;
@@ -900,6 +927,7 @@ static int virtnet_probe(struct virtio_device *vdev)
 	vdev->priv = vi;
 	vi->pages = NULL;
 	INIT_DELAYED_WORK(&vi->refill, refill_work);
+	tasklet_init(&vi->tx_tasklet, xmit_tasklet, (unsigned long)vi);
 
 	/* If we can receive ANY GSO packets, we must allocate large ones. */
 	if (virtio_has_feature(vdev, VIRTIO_NET_F_GUEST_TSO4)
@@ -972,6 +1000,7 @@ static void __devexit virtnet_remove(struct virtio_device *vdev)
 
 	/* Stop all the virtqueues. */
 	vdev->config->reset(vdev);
+	tasklet_kill(&vi->tx_tasklet);
 
 	/* Free our skbs in send and recv queues, if any. */
 	while ((skb = __skb_dequeue(&vi->recv)) != NULL) {
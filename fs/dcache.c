@@ -33,6 +33,7 @@
 #include <linux/bootmem.h>
 #include <linux/fs_struct.h>
 #include <linux/hardirq.h>
+#include <linux/percpu_counter.h>
 #include "internal.h"
 
 int sysctl_vfs_cache_pressure __read_mostly = 100;
@@ -67,6 +68,24 @@ struct dentry_stat_t dentry_stat = {
 	.age_limit = 45,
 };
 
+/* dentries on the LRUs; updated under each superblock's s_dentry_lru_lock */
+static struct percpu_counter nr_dentry_unused __cacheline_aligned_in_smp;
+
+#if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
+int proc_nr_dentry(ctl_table *table, int write,
+		   void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	dentry_stat.nr_unused = percpu_counter_sum_positive(&nr_dentry_unused);
+	return proc_dointvec(table, write, buffer, lenp, ppos);
+}
+#else
+int proc_nr_dentry(ctl_table *table, int write,
+		   void __user *buffer, size_t *lenp, loff_t *ppos)
+{
+	return -ENOSYS;
+}
+#endif
+
 static void __d_free(struct dentry *dentry)
 {
 	WARN_ON(!list_empty(&dentry->d_alias));
@@ -106,7 +125,10 @@ static void dentry_iput(struct dentry * dentry)
 {
 	struct inode *inode = dentry->d_inode;
 	if (inode) {
+		write_seqcount_begin(&dentry->d_seq);
 		dentry->d_inode = NULL;
+		dentry->d_flags &= ~DCACHE_RCUWALK_DIR;
+		write_seqcount_end(&dentry->d_seq);
 		list_del_init(&dentry->d_alias);
 		spin_unlock(&dentry->d_lock);
 		spin_unlock(&dcache_lock);
@@ -123,38 +145,62 @@ static void dentry_iput(struct dentry * dentry)
 }
 
 /*
- * dentry_lru_(add|add_tail|del|del_init) must be called with dcache_lock held.
+ * The unused dentry LRU is per superblock and protected by its
+ * s_dentry_lru_lock, which nests inside dentry->d_lock.  Adding a dentry
+ * requires its d_lock, so that dput() can test list_empty(&d_lru) under
+ * d_lock alone.  Taking one off requires d_lock or dcache_lock; since
+ * neither excludes the other, the removal helpers only trust
+ * list_empty(&d_lru) once they hold the LRU lock.
  */
 static void dentry_lru_add(struct dentry *dentry)
 {
-	list_add(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-	dentry->d_sb->s_nr_dentry_unused++;
-	dentry_stat.nr_unused++;
+	struct super_block *sb = dentry->d_sb;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	list_add(&dentry->d_lru, &sb->s_dentry_lru);
+	sb->s_nr_dentry_unused++;
+	spin_unlock(&sb->s_dentry_lru_lock);
+	percpu_counter_inc(&nr_dentry_unused);
 }
 
 static void dentry_lru_add_tail(struct dentry *dentry)
 {
-	list_add_tail(&dentry->d_lru, &dentry->d_sb->s_dentry_lru);
-	dentry->d_sb->s_nr_dentry_unused++;
-	dentry_stat.nr_unused++;
+	struct super_block *sb = dentry->d_sb;
+
+	spin_lock(&sb->s_dentry_lru_lock);
+	list_add_tail(&dentry->d_lru, &sb->s_dentry_lru);
+	sb->s_nr_dentry_unused++;
+	spin_unlock(&sb->s_dentry_lru_lock);
+	percpu_counter_inc(&nr_dentry_unused);
 }
 
-static void dentry_lru_del(struct dentry *dentry)
+static void __dentry_lru_del(struct dentry *dentry, int init)
 {
+	struct super_block *sb = dentry->d_sb;
+	int removed = 0;
+
+	spin_lock(&sb->s_dentry_lru_lock);
 	if (!list_empty(&dentry->d_lru)) {
-		list_del(&dentry->d_lru);
-		dentry->d_sb->s_nr_dentry_unused--;
-		dentry_stat.nr_unused--;
+		if (init)
+			list_del_init(&dentry->d_lru);
+		else
+			list_del(&dentry->d_lru);
+		sb->s_nr_dentry_unused--;
+		removed = 1;
 	}
+	spin_unlock(&sb->s_dentry_lru_lock);
+	if (removed)
+		percpu_counter_dec(&nr_dentry_unused);
+}
+
+static void dentry_lru_del(struct dentry *dentry)
+{
+	__dentry_lru_del(dentry, 0);
 }
 
 static void dentry_lru_del_init(struct dentry *dentry)
 {
-	if (likely(!list_empty(&dentry->d_lru))) {
-		list_del_init(&dentry->d_lru);
-		dentry->d_sb->s_nr_dentry_unused--;
-		dentry_stat.nr_unused--;
-	}
+	__dentry_lru_del(dentry, 1);
 }
 
 /**
@@ -220,6 +266,29 @@ void dput(struct dentry *dentry)
 repeat:
 	if (atomic_read(&dentry->d_count) == 1)
 		might_sleep();
+	if (!atomic_dec_and_lock(&dentry->d_count, &dentry->d_lock))
+		return;
+
+	/*
+	 * Common case: a hashed dentry going unused just stays cached.
+	 * Putting it on the LRU only needs d_lock and the LRU lock.
+	 */
+	if (!d_unhashed(dentry) &&
+	    !(dentry->d_op && dentry->d_op->d_delete)) {
+		if (list_empty(&dentry->d_lru)) {
+			dentry->d_flags |= DCACHE_REFERENCED;
+			dentry_lru_add(dentry);
+		}
+		spin_unlock(&dentry->d_lock);
+		return;
+	}
+
+	/*
+	 * It may have to go away, which needs dcache_lock.  Take the
+	 * reference back and drop it again the slow way.
+	 */
+	atomic_inc(&dentry->d_count);
+	spin_unlock(&dentry->d_lock);
 	if (!atomic_dec_and_lock(&dentry->d_count, &dcache_lock))
 		return;
 
@@ -465,6 +534,7 @@ static void __shrink_dcache_sb(struct super_block *sb, int *count, int flags)
 		/* called from prune_dcache() and shrink_dcache_parent() */
 		cnt = *count;
 restart:
+	spin_lock(&sb->s_dentry_lru_lock);
 	if (count == NULL)
 		list_splice_init(&sb->s_dentry_lru, &tmp);
 	else {
@@ -473,7 +543,13 @@ restart:
 					struct dentry, d_lru);
 			BUG_ON(dentry->d_sb != sb);
 
-			spin_lock(&dentry->d_lock);
+			/* d_lock nests outside the LRU lock */
+			if (!spin_trylock(&dentry->d_lock)) {
+				spin_unlock(&sb->s_dentry_lru_lock);
+				cpu_relax();
+				spin_lock(&sb->s_dentry_lru_lock);
+				continue;
+			}
 			/*
 			 * If we are honouring the DCACHE_REFERENCED flag and
 			 * the dentry has this flag set, don't free it. Clear
@@ -491,9 +567,14 @@ restart:
 				if (!cnt)
 					break;
 			}
-			cond_resched_lock(&dcache_lock);
+			if (need_resched()) {
+				spin_unlock(&sb->s_dentry_lru_lock);
+				cond_resched_lock(&dcache_lock);
+				spin_lock(&sb->s_dentry_lru_lock);
+			}
 		}
 	}
+	spin_unlock(&sb->s_dentry_lru_lock);
 	while (!list_empty(&tmp)) {
 		dentry = list_entry(tmp.prev, struct dentry, d_lru);
 		dentry_lru_del_init(dentry);
@@ -515,8 +596,11 @@ restart:
 		goto restart;
 	if (count != NULL)
 		*count = cnt;
-	if (!list_empty(&referenced))
+	if (!list_empty(&referenced)) {
+		spin_lock(&sb->s_dentry_lru_lock);
 		list_splice(&referenced, &sb->s_dentry_lru);
+		spin_unlock(&sb->s_dentry_lru_lock);
+	}
 	spin_unlock(&dcache_lock);
 }
 
@@ -533,7 +617,7 @@ static void prune_dcache(int count)
 {
 	struct super_block *sb;
 	int w_count;
-	int unused = dentry_stat.nr_unused;
+	int unused = percpu_counter_read_positive(&nr_dentry_unused);
 	int prune_ratio;
 	int pruned;
 
@@ -822,6 +906,7 @@ resume:
 		struct dentry *dentry = list_entry(tmp, struct dentry, d_u.d_child);
 		next = tmp->next;
 
+		spin_lock(&dentry->d_lock);
 		dentry_lru_del_init(dentry);
 		/* 
 		 * move only zero ref count dentries to the end 
@@ -831,6 +916,7 @@ resume:
 			dentry_lru_add_tail(dentry);
 			found++;
 		}
+		spin_unlock(&dentry->d_lock);
 
 		/*
 		 * We can return to the caller if we have found some (this
@@ -896,7 +982,8 @@ static int shrink_dcache_memory(int nr, gfp_t gfp_mask)
 			return -1;
 		prune_dcache(nr);
 	}
-	return (dentry_stat.nr_unused / 100) * sysctl_vfs_cache_pressure;
+	return (percpu_counter_read_positive(&nr_dentry_unused) / 100) *
+		sysctl_vfs_cache_pressure;
 }
 
 static struct shrinker dcache_shrinker = {
@@ -942,6 +1029,7 @@ struct dentry *d_alloc(struct dentry * parent, const struct qstr *name)
 	atomic_set(&dentry->d_count, 1);
 	dentry->d_flags = DCACHE_UNHASHED;
 	spin_lock_init(&dentry->d_lock);
+	seqcount_init(&dentry->d_seq);
 	dentry->d_inode = NULL;
 	dentry->d_parent = NULL;
 	dentry->d_sb = NULL;
@@ -979,11 +1067,27 @@ struct dentry *d_alloc_name(struct dentry *parent, const char *name)
 	return d_alloc(parent, &q);
 }
 
+/*
+ * Directories that path lookup may pass through in rcu-walk mode: no
+ * symlink behaviour and no ->permission() of their own.  This is worked
+ * out once here so that rcu-walk never has to follow inode->i_op.
+ */
+static inline unsigned int d_rcuwalk_flags(struct inode *inode)
+{
+	if (inode && S_ISDIR(inode->i_mode) && inode->i_op->lookup &&
+	    !inode->i_op->follow_link && !inode->i_op->permission)
+		return DCACHE_RCUWALK_DIR;
+	return 0;
+}
+
 /* the caller must hold dcache_lock */
 static void __d_instantiate(struct dentry *dentry, struct inode *inode)
 {
 	if (inode)
 		list_add(&dentry->d_alias, &inode->i_dentry);
+	spin_lock(&dentry->d_lock);
+	dentry->d_flags |= d_rcuwalk_flags(inode);
+	spin_unlock(&dentry->d_lock);
 	dentry->d_inode = inode;
 	fsnotify_d_instantiate(dentry, inode);
 }
@@ -1168,7 +1272,7 @@ struct dentry *d_obtain_alias(struct inode *inode)
 	spin_lock(&tmp->d_lock);
 	tmp->d_sb = inode->i_sb;
 	tmp->d_inode = inode;
-	tmp->d_flags |= DCACHE_DISCONNECTED;
+	tmp->d_flags |= DCACHE_DISCONNECTED | d_rcuwalk_flags(inode);
 	tmp->d_flags &= ~DCACHE_UNHASHED;
 	list_add(&tmp->d_alias, &inode->i_dentry);
 	hlist_add_head(&tmp->d_hash, &inode->i_sb->s_anon);
@@ -1421,6 +1525,48 @@ next:
  	return found;
 }
 
+/**
+ * __d_lookup_rcu - search for a dentry without locks or references
+ * @parent: parent dentry
+ * @name: qstr of name we wish to find
+ * @seq: returns the d_seq count of the dentry found
+ *
+ * Used by path lookup in rcu-walk mode.  The caller holds rcu_read_lock()
+ * and must check read_seqcount_retry(&dentry->d_seq, *seq) before trusting
+ * anything it read from the dentry: d_move() may be rewriting the name
+ * while we compare it.  Names are compared with memcmp(), so this must not
+ * be used below a parent with its own d_compare().
+ */
+struct dentry *__d_lookup_rcu(struct dentry *parent, struct qstr *name,
+			      unsigned *seq)
+{
+	unsigned int len = name->len;
+	unsigned int hash = name->hash;
+	const unsigned char *str = name->name;
+	struct hlist_head *head = d_hash(parent, hash);
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	hlist_for_each_entry_rcu(dentry, node, head, d_hash) {
+		unsigned s;
+
+		if (dentry->d_name.hash != hash)
+			continue;
+		s = read_seqcount_begin(&dentry->d_seq);
+		if (dentry->d_parent != parent)
+			continue;
+		if (d_unhashed(dentry))
+			continue;
+		if (dentry->d_name.len != len)
+			continue;
+		if (memcmp(dentry->d_name.name, str, len))
+			continue;
+		*seq = s;
+		return dentry;
+	}
+	return NULL;
+}
+
 /**
  * d_hash_and_lookup - hash the qstr then search for a dentry
  * @dir: Directory to search in
@@ -1649,6 +1795,8 @@ static void d_move_locked(struct dentry * dentry, struct dentry * target)
 		spin_lock(&dentry->d_lock);
 		spin_lock_nested(&target->d_lock, DENTRY_D_LOCK_NESTED);
 	}
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&target->d_seq);
 
 	/* Move the dentry to the target hash queue, if on different bucket */
 	if (d_unhashed(dentry))
@@ -1683,6 +1831,8 @@ already_unhashed:
 	}
 
 	list_add(&dentry->d_u.d_child, &dentry->d_parent->d_subdirs);
+	write_seqcount_end(&target->d_seq);
+	write_seqcount_end(&dentry->d_seq);
 	spin_unlock(&target->d_lock);
 	fsnotify_d_move(dentry);
 	spin_unlock(&dentry->d_lock);
@@ -1776,6 +1926,9 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 {
 	struct dentry *dparent, *aparent;
 
+	/* d_seq writers are serialised by dcache_lock, which we hold */
+	write_seqcount_begin(&dentry->d_seq);
+	write_seqcount_begin(&anon->d_seq);
 	switch_names(dentry, anon);
 	swap(dentry->d_name.hash, anon->d_name.hash);
 
@@ -1797,6 +1950,8 @@ static void __d_materialise_dentry(struct dentry *dentry, struct dentry *anon)
 		INIT_LIST_HEAD(&anon->d_u.d_child);
 
 	anon->d_flags &= ~DCACHE_DISCONNECTED;
+	write_seqcount_end(&anon->d_seq);
+	write_seqcount_end(&dentry->d_seq);
 }
 
 /**
@@ -1912,7 +2067,7 @@ char *__d_path(const struct path *path, struct path *root,
 	char *end = buffer + buflen;
 	char *retval;
 
-	spin_lock(&vfsmount_lock);
+	br_read_lock(vfsmount_lock);
 	prepend(&end, &buflen, "\0", 1);
 	if (d_unlinked(dentry) &&
 		(prepend(&end, &buflen, " (deleted)", 10) != 0))
@@ -1948,7 +2103,7 @@ char *__d_path(const struct path *path, struct path *root,
 	}
 
 out:
-	spin_unlock(&vfsmount_lock);
+	br_read_unlock(vfsmount_lock);
 	return retval;
 
 global_root:
@@ -2276,7 +2431,8 @@ static void __init dcache_init(void)
 	 */
 	dentry_cache = KMEM_CACHE(dentry,
 		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
-	
+
+	percpu_counter_init(&nr_dentry_unused, 0);
 	register_shrinker(&dcache_shrinker);
 
 	/* Hash may have been set up in dcache_init_early */
@@ -22,6 +22,8 @@
 #include <linux/fsnotify.h>
 #include <linux/sysctl.h>
 #include <linux/percpu_counter.h>
+#include <linux/percpu.h>
+#include <linux/lglock.h>
 
 #include <asm/atomic.h>
 
@@ -30,8 +32,12 @@ struct files_stat_struct files_stat = {
 	.max_files = NR_FILE
 };
 
-/* public. Not pretty! */
-__cacheline_aligned_in_smp DEFINE_SPINLOCK(files_lock);
+/*
+ * sb->s_files is split per-cpu: open and close only take the lock of the
+ * list the file is on, while the rare walkers (remount r/o) take them all.
+ */
+DECLARE_LGLOCK(files_lglock);
+DEFINE_LGLOCK(files_lglock);
 
 /* SLAB cache for file structures */
 static struct kmem_cache *filp_cachep __read_mostly;
@@ -286,7 +292,7 @@ void __fput(struct file *file)
 		cdev_put(inode->i_cdev);
 	fops_put(file->f_op);
 	put_pid(file->f_owner.pid);
-	file_kill(file);
+	file_sb_list_del(file);
 	if (file->f_mode & FMODE_WRITE)
 		drop_file_write_access(file);
 	file->f_path.dentry = NULL;
@@ -354,36 +360,94 @@ void put_filp(struct file *file)
 {
 	if (atomic_long_dec_and_test(&file->f_count)) {
 		security_file_free(file);
-		file_kill(file);
+		file_sb_list_del(file);
 		file_free(file);
 	}
 }
 
-void file_move(struct file *file, struct list_head *list)
+#ifdef CONFIG_SMP
+static inline int file_list_cpu(struct file *file)
 {
-	if (!list)
-		return;
-	file_list_lock();
-	list_move(&file->f_u.fu_list, list);
-	file_list_unlock();
+	return file->f_sb_list_cpu;
+}
+
+static inline struct list_head *file_sb_list(struct super_block *sb, int cpu)
+{
+	return per_cpu_ptr(sb->s_files, cpu);
+}
+#else
+static inline int file_list_cpu(struct file *file)
+{
+	return smp_processor_id();
+}
+
+static inline struct list_head *file_sb_list(struct super_block *sb, int cpu)
+{
+	return &sb->s_files;
 }
+#endif
 
-void file_kill(struct file *file)
+/**
+ *	file_sb_list_add - add a file to the sb's file list
+ *	@file: file to add
+ *	@sb: sb to add it to
+ *
+ *	Use this function to associate a file with the superblock of the inode
+ *	it refers to.  The file goes on this cpu's list.
+ */
+void file_sb_list_add(struct file *file, struct super_block *sb)
+{
+	int cpu;
+
+	lg_local_lock(files_lglock);
+	cpu = smp_processor_id();
+#ifdef CONFIG_SMP
+	file->f_sb_list_cpu = cpu;
+#endif
+	list_add(&file->f_u.fu_list, file_sb_list(sb, cpu));
+	lg_local_unlock(files_lglock);
+}
+
+/**
+ *	file_sb_list_del - remove a file from the sb's file list
+ *	@file: file to remove
+ *
+ *	Use this function to remove a file from its superblock.  It takes the
+ *	lock of the cpu the file was added on, not of the current one.
+ */
+void file_sb_list_del(struct file *file)
 {
 	if (!list_empty(&file->f_u.fu_list)) {
-		file_list_lock();
+		int cpu = file_list_cpu(file);
+
+		lg_local_lock_cpu(files_lglock, cpu);
 		list_del_init(&file->f_u.fu_list);
-		file_list_unlock();
+		lg_local_unlock_cpu(files_lglock, cpu);
 	}
 }
 
+/*
+ * Walk every file on @__sb.  The caller holds lg_global_lock(files_lglock).
+ */
+#define do_file_list_for_each_entry(__sb, __file)		\
+{								\
+	int i;							\
+	for_each_possible_cpu(i) {				\
+		struct list_head *list;				\
+		list = file_sb_list((__sb), i);			\
+		list_for_each_entry((__file), list, f_u.fu_list)
+
+#define while_file_list_for_each_entry				\
+	}							\
+}
+
 int fs_may_remount_ro(struct super_block *sb)
 {
 	struct file *file;
 
 	/* Check that no files are currently opened for writing. */
-	file_list_lock();
-	list_for_each_entry(file, &sb->s_files, f_u.fu_list) {
+	lg_global_lock(files_lglock);
+	do_file_list_for_each_entry(sb, file) {
 		struct inode *inode = file->f_path.dentry->d_inode;
 
 		/* File with pending delete? */
@@ -393,11 +457,11 @@ int fs_may_remount_ro(struct super_block *sb)
 		/* Writeable file? */
 		if (S_ISREG(inode->i_mode) && (file->f_mode & FMODE_WRITE))
 			goto too_bad;
-	}
-	file_list_unlock();
+	} while_file_list_for_each_entry;
+	lg_global_unlock(files_lglock);
 	return 1; /* Tis' cool bro. */
 too_bad:
-	file_list_unlock();
+	lg_global_unlock(files_lglock);
 	return 0;
 }
 
@@ -413,8 +477,8 @@ void mark_files_ro(struct super_block *sb)
 	struct file *f;
 
 retry:
-	file_list_lock();
-	list_for_each_entry(f, &sb->s_files, f_u.fu_list) {
+	lg_global_lock(files_lglock);
+	do_file_list_for_each_entry(sb, f) {
 		struct vfsmount *mnt;
 		if (!S_ISREG(f->f_path.dentry->d_inode->i_mode))
 		       continue;
@@ -429,16 +493,16 @@ retry:
 			continue;
 		file_release_write(f);
 		mnt = mntget(f->f_path.mnt);
-		file_list_unlock();
+		lg_global_unlock(files_lglock);
 		/*
 		 * This can sleep, so we can't hold
-		 * the file_list_lock() spinlock.
+		 * the files_lglock.
 		 */
 		mnt_drop_write(mnt);
 		mntput(mnt);
 		goto retry;
-	}
-	file_list_unlock();
+	} while_file_list_for_each_entry;
+	lg_global_unlock(files_lglock);
 }
 
 void __init files_init(unsigned long mempages)
@@ -458,5 +522,6 @@ void __init files_init(unsigned long mempages)
 	if (files_stat.max_files < NR_FILE)
 		files_stat.max_files = NR_FILE;
 	files_defer_init();
+	lg_lock_init(files_lglock);
 	percpu_counter_init(&nr_files, 0);
 } 
@@ -27,6 +27,7 @@
 #include <linux/mount.h>
 #include <linux/async.h>
 #include <linux/posix_acl.h>
+#include "internal.h"
 
 /*
  * This is needed for the following functions:
@@ -64,19 +65,17 @@ static unsigned int i_hash_mask __read_mostly;
 static unsigned int i_hash_shift __read_mostly;
 
 /*
- * Each inode can be on two separate lists. One is
- * the hash list of the inode, used for lookups. The
- * other linked list is the "type" list:
- *  "in_use" - valid inode, i_count > 0, i_nlink > 0
- *  "dirty"  - as "in_use" but also dirty
- *  "unused" - valid inode, i_count = 0
+ * Each inode can be on three separate lists. One is
+ * the hash list of the inode, used for lookups. i_list
+ * puts a dirty inode on its backing device's writeback
+ * lists, and i_lru puts an unused inode on inode_unused.
  *
- * A "dirty" list is maintained for each super block,
- * allowing for low-overhead inode sync() operations.
+ * The unused list is lazy: an inode picked up again by
+ * __iget() stays on it until prune_icache() finds it
+ * busy and takes it off.
  */
 
-LIST_HEAD(inode_in_use);
-LIST_HEAD(inode_unused);
+static LIST_HEAD(inode_unused);
 static struct hlist_head *inode_hashtable __read_mostly;
 
 /*
@@ -87,6 +86,16 @@ static struct hlist_head *inode_hashtable __read_mostly;
  */
 DEFINE_SPINLOCK(inode_lock);
 
+/*
+ * inode_lru_lock protects inode_unused and inodes_stat.nr_unused, and nests
+ * inside inode_lock.  iput() drops the last reference to an inode that stays
+ * cached under inode_lru_lock alone, so whoever frees unused inodes must hold
+ * it while checking i_count.  inode->i_lock is not used for this: filesystems
+ * take inode_lock under it (igrab() with i_lock held in NFS, for one), so it
+ * must never be taken under inode_lock.
+ */
+static DEFINE_SPINLOCK(inode_lru_lock);
+
 /*
  * iprune_sem provides exclusion between the kswapd or try_to_free_pages
  * icache shrinking path, and the umount path.  Without this exclusion,
@@ -279,6 +288,8 @@ void inode_init_once(struct inode *inode)
 {
 	memset(inode, 0, sizeof(*inode));
 	INIT_HLIST_NODE(&inode->i_hash);
+	INIT_LIST_HEAD(&inode->i_list);
+	INIT_LIST_HEAD(&inode->i_lru);
 	INIT_LIST_HEAD(&inode->i_dentry);
 	INIT_LIST_HEAD(&inode->i_devices);
 	address_space_init_once(&inode->i_data);
@@ -305,14 +316,42 @@ static void init_once(void *foo)
  */
 void __iget(struct inode *inode)
 {
-	if (atomic_read(&inode->i_count)) {
-		atomic_inc(&inode->i_count);
-		return;
-	}
 	atomic_inc(&inode->i_count);
-	if (!(inode->i_state & (I_DIRTY|I_SYNC)))
-		list_move(&inode->i_list, &inode_in_use);
-	inodes_stat.nr_unused--;
+}
+
+/*
+ * Put an unused inode on the LRU unless it is there already.  Dirty ones
+ * are welcome too: prune_icache() drops them and writeback puts them back
+ * once they are clean.
+ */
+static void __inode_lru_list_add(struct inode *inode)
+{
+	if (list_empty(&inode->i_lru)) {
+		list_add(&inode->i_lru, &inode_unused);
+		inodes_stat.nr_unused++;
+	}
+}
+
+void inode_lru_list_add(struct inode *inode)
+{
+	spin_lock(&inode_lru_lock);
+	__inode_lru_list_add(inode);
+	spin_unlock(&inode_lru_lock);
+}
+
+static void __inode_lru_list_del(struct inode *inode)
+{
+	if (!list_empty(&inode->i_lru)) {
+		list_del_init(&inode->i_lru);
+		inodes_stat.nr_unused--;
+	}
+}
+
+static void inode_lru_list_del(struct inode *inode)
+{
+	spin_lock(&inode_lru_lock);
+	__inode_lru_list_del(inode);
+	spin_unlock(&inode_lru_lock);
 }
 
 /**
@@ -357,8 +396,8 @@ static void dispose_list(struct list_head *head)
 	while (!list_empty(head)) {
 		struct inode *inode;
 
-		inode = list_first_entry(head, struct inode, i_list);
-		list_del(&inode->i_list);
+		inode = list_first_entry(head, struct inode, i_lru);
+		list_del_init(&inode->i_lru);
 
 		if (inode->i_data.nrpages)
 			truncate_inode_pages(&inode->i_data, 0);
@@ -406,17 +445,20 @@ static int invalidate_list(struct list_head *head, struct list_head *dispose)
 		if (inode->i_state & I_NEW)
 			continue;
 		invalidate_inode_buffers(inode);
+		spin_lock(&inode_lru_lock);
 		if (!atomic_read(&inode->i_count)) {
-			list_move(&inode->i_list, dispose);
+			list_del_init(&inode->i_list);
+			__inode_lru_list_del(inode);
+			list_add(&inode->i_lru, dispose);
 			WARN_ON(inode->i_state & I_NEW);
 			inode->i_state |= I_FREEING;
+			spin_unlock(&inode_lru_lock);
 			count++;
 			continue;
 		}
+		spin_unlock(&inode_lru_lock);
 		busy = 1;
 	}
-	/* only unused inodes may be cached with i_count zero */
-	inodes_stat.nr_unused -= count;
 	return busy;
 }
 
@@ -470,6 +512,9 @@ static int can_unuse(struct inode *inode)
  * inode is still freeable, proceed.  The right inode is found 99.9% of the
  * time in testing on a 4-way.
  *
+ * Inodes that are in use again or dirty are taken off the list here; iput()
+ * and writeback put them back when they become unused and clean.
+ *
  * If the inode has metadata buffers attached to mapping->private_list then
  * try to remove them.
  */
@@ -482,39 +527,44 @@ static void prune_icache(int nr_to_scan)
 
 	down_read(&iprune_sem);
 	spin_lock(&inode_lock);
+	spin_lock(&inode_lru_lock);
 	for (nr_scanned = 0; nr_scanned < nr_to_scan; nr_scanned++) {
 		struct inode *inode;
 
 		if (list_empty(&inode_unused))
 			break;
 
-		inode = list_entry(inode_unused.prev, struct inode, i_list);
+		inode = list_entry(inode_unused.prev, struct inode, i_lru);
 
 		if (inode->i_state || atomic_read(&inode->i_count)) {
-			list_move(&inode->i_list, &inode_unused);
+			__inode_lru_list_del(inode);
 			continue;
 		}
 		if (inode_has_buffers(inode) || inode->i_data.nrpages) {
+			__inode_lru_list_del(inode);
 			__iget(inode);
+			spin_unlock(&inode_lru_lock);
 			spin_unlock(&inode_lock);
 			if (remove_inode_buffers(inode))
 				reap += invalidate_mapping_pages(&inode->i_data,
 								0, -1);
 			iput(inode);
 			spin_lock(&inode_lock);
+			spin_lock(&inode_lru_lock);
 
 			if (inode != list_entry(inode_unused.next,
-						struct inode, i_list))
+						struct inode, i_lru))
 				continue;	/* wrong inode or list_empty */
 			if (!can_unuse(inode))
 				continue;
 		}
-		list_move(&inode->i_list, &freeable);
+		list_move(&inode->i_lru, &freeable);
+		inodes_stat.nr_unused--;
 		WARN_ON(inode->i_state & I_NEW);
 		inode->i_state |= I_FREEING;
 		nr_pruned++;
 	}
-	inodes_stat.nr_unused -= nr_pruned;
+	spin_unlock(&inode_lru_lock);
 	if (current_is_kswapd())
 		__count_vm_events(KSWAPD_INODESTEAL, reap);
 	else
@@ -624,7 +674,6 @@ __inode_add_to_lists(struct super_block *sb, struct hlist_head *head,
 			struct inode *inode)
 {
 	inodes_stat.nr_inodes++;
-	list_add(&inode->i_list, &inode_in_use);
 	list_add(&inode->i_sb_list, &sb->s_inodes);
 	if (head)
 		hlist_add_head(&inode->i_hash, head);
@@ -1219,6 +1268,7 @@ void generic_delete_inode(struct inode *inode)
 	const struct super_operations *op = inode->i_sb->s_op;
 
 	list_del_init(&inode->i_list);
+	inode_lru_list_del(inode);
 	list_del_init(&inode->i_sb_list);
 	WARN_ON(inode->i_state & I_NEW);
 	inode->i_state |= I_FREEING;
@@ -1263,10 +1313,8 @@ int generic_detach_inode(struct inode *inode)
 	struct super_block *sb = inode->i_sb;
 
 	if (!hlist_unhashed(&inode->i_hash)) {
-		if (!(inode->i_state & (I_DIRTY|I_SYNC)))
-			list_move(&inode->i_list, &inode_unused);
-		inodes_stat.nr_unused++;
 		if (sb->s_flags & MS_ACTIVE) {
+			inode_lru_list_add(inode);
 			spin_unlock(&inode_lock);
 			return 0;
 		}
@@ -1277,10 +1325,10 @@ int generic_detach_inode(struct inode *inode)
 		spin_lock(&inode_lock);
 		WARN_ON(inode->i_state & I_NEW);
 		inode->i_state &= ~I_WILL_FREE;
-		inodes_stat.nr_unused--;
 		hlist_del_init(&inode->i_hash);
 	}
 	list_del_init(&inode->i_list);
+	inode_lru_list_del(inode);
 	list_del_init(&inode->i_sb_list);
 	WARN_ON(inode->i_state & I_NEW);
 	inode->i_state |= I_FREEING;
@@ -1336,6 +1384,18 @@ static inline void iput_final(struct inode *inode)
 	drop(inode);
 }
 
+/*
+ * Would generic_drop_inode() just leave this inode cached?  Then the last
+ * reference can go without inode_lock.  Called with inode_lru_lock held.
+ */
+static inline int iput_keep_cached(struct inode *inode)
+{
+	struct super_block *sb = inode->i_sb;
+
+	return inode->i_nlink && !hlist_unhashed(&inode->i_hash) &&
+	       !sb->s_op->drop_inode && (sb->s_flags & MS_ACTIVE);
+}
+
 /**
  *	iput	- put an inode
  *	@inode: inode to put
@@ -1350,6 +1410,16 @@ void iput(struct inode *inode)
 	if (inode) {
 		BUG_ON(inode->i_state == I_CLEAR);
 
+		if (!atomic_dec_and_lock(&inode->i_count, &inode_lru_lock))
+			return;
+		if (iput_keep_cached(inode)) {
+			__inode_lru_list_add(inode);
+			spin_unlock(&inode_lru_lock);
+			return;
+		}
+		/* it may have to go: drop the reference again under inode_lock */
+		atomic_inc(&inode->i_count);
+		spin_unlock(&inode_lru_lock);
 		if (atomic_dec_and_lock(&inode->i_count, &inode_lock))
 			iput_final(inode);
 	}
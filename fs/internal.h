@@ -80,6 +80,11 @@ extern void chroot_fs_refs(struct path *, struct path *);
  */
 extern void mark_files_ro(struct super_block *);
 
+/*
+ * inode.c
+ */
+extern void inode_lru_list_add(struct inode *inode);
+
 /*
  * super.c
  */
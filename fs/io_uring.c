@@ -0,0 +1,1455 @@
+/*
+ *  fs/io_uring.c
+ *
+ *  Shared application/kernel submission and completion rings.
+ *
+ *  io_uring_setup() returns a file whose mmap() exposes three areas:
+ *  the submission queue ring, an array of submission queue entries
+ *  (sqes) indexed by it, and the completion queue ring.  The application
+ *  fills sqes, publishes their indices at the sq tail and consumes
+ *  completion entries (cqes) from the cq head; the kernel consumes the
+ *  sq head and produces at the cq tail.  Nothing is copied in or out by
+ *  a syscall, and io_uring_enter() both submits and waits for any number
+ *  of requests at once.
+ *
+ *  With IORING_SETUP_SQPOLL a kernel thread polls the sq ring, so an
+ *  application that keeps it busy submits and reaps I/O without entering
+ *  the kernel at all.  The thread only goes to sleep, and asks to be
+ *  woken through IORING_SQ_NEED_WAKEUP, after sq_thread_idle msecs
+ *  without new entries.
+ *
+ *  Files and buffers can be registered up front with io_uring_register():
+ *  requests on a registered file skip the fget()/fput() pair, and the
+ *  pages of registered buffers are pinned once for the lifetime of the
+ *  registration instead of being faulted in for every request.
+ *
+ *  Reads, writes and fsyncs are run from a per-ring worker thread, so they
+ *  complete asynchronously whether or not the file supports O_DIRECT.
+ *  Poll requests are armed from the submitting context and completed
+ *  from the file's wakeup.
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/mmu_context.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/anon_inodes.h>
+#include <linux/log2.h>
+#include <linux/cred.h>
+#include <linux/capability.h>
+#include <linux/io_uring.h>
+
+#include <asm/io.h>
+#include <asm/uaccess.h>
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+#define IORING_MAX_BUF_SIZE	(1UL << 30)
+
+struct io_uring {
+	u32 head ____cacheline_aligned_in_smp;
+	u32 tail ____cacheline_aligned_in_smp;
+};
+
+/*
+ * Layout of the sq ring mapping.  The sqes themselves live in their own
+ * mapping, array[] holds indices into it.
+ */
+struct io_sq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			dropped;	/* invalid indices skipped */
+	u32			flags;
+	u32			array[];
+};
+
+/*
+ * Layout of the cq ring mapping.
+ */
+struct io_cq_ring {
+	struct io_uring		r;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;	/* cqes lost to a full ring */
+	struct io_uring_cqe	cqes[];
+};
+
+struct io_mapped_ubuf {
+	unsigned long		ubuf;
+	size_t			len;
+	struct page		**pages;
+	unsigned int		nr_pages;
+};
+
+struct io_ring_ctx {
+	struct {
+		struct io_sq_ring	*sq_ring;
+		unsigned		cached_sq_head;
+		unsigned		sq_entries;
+		unsigned		sq_mask;
+		struct io_uring_sqe	*sq_sqes;
+	} ____cacheline_aligned_in_smp;
+
+	unsigned int		flags;
+	unsigned long		sq_thread_idle;
+	struct task_struct	*sqo_thread;
+	wait_queue_head_t	sqo_wait;
+
+	/* async requests run here, as the ring's creator */
+	struct workqueue_struct	*sqo_wq;
+	struct mm_struct	*sqo_mm;
+	const struct cred	*creds;
+
+	/* the worker while it runs a request, and whether the ring is gone */
+	spinlock_t		wq_lock;
+	struct task_struct	*wq_task;
+	bool			dying;
+
+	/* submission, registration; held by the sq thread while it submits */
+	struct mutex		uring_lock;
+	atomic_t		inflight;
+
+	struct file		**user_files;
+	unsigned		nr_user_files;
+	struct io_mapped_ubuf	*user_bufs;
+	unsigned		nr_user_bufs;
+
+	struct {
+		struct io_cq_ring	*cq_ring;
+		unsigned		cached_cq_tail;
+		unsigned		cq_entries;
+		unsigned		cq_mask;
+		wait_queue_head_t	wait;		/* io_uring_enter() */
+		wait_queue_head_t	cq_wait;	/* poll(2) on the ring */
+	} ____cacheline_aligned_in_smp;
+
+	struct {
+		spinlock_t		completion_lock;
+		struct list_head	cancel_list;	/* armed polls */
+	} ____cacheline_aligned_in_smp;
+
+	struct work_struct	exit_work;
+};
+
+struct io_poll_iocb {
+	wait_queue_head_t	*head;
+	unsigned int		events;
+	bool			canceled;
+	bool			done;		/* under ctx->completion_lock */
+	wait_queue_t		wait;
+};
+
+struct io_kiocb {
+	struct io_ring_ctx	*ctx;
+	atomic_t		refs;
+	struct file		*file;
+	struct list_head	list;
+	unsigned int		flags;
+	struct work_struct	work;
+	struct io_poll_iocb	poll;
+	struct io_uring_sqe	sqe;	/* the sq slot is reused once consumed */
+};
+
+#define REQ_F_FIXED_FILE	1	/* file from ctx->user_files, no reference */
+
+static struct kmem_cache *req_cachep;
+static struct workqueue_struct *io_uring_exit_wq;
+
+static const struct file_operations io_uring_fops;
+
+static unsigned io_cqring_events(struct io_cq_ring *ring)
+{
+	return ACCESS_ONCE(ring->r.tail) - ACCESS_ONCE(ring->r.head);
+}
+
+static unsigned io_sqring_entries(struct io_ring_ctx *ctx)
+{
+	return ACCESS_ONCE(ctx->sq_ring->r.tail) - ctx->cached_sq_head;
+}
+
+/*
+ * Called with ctx->completion_lock held.  If the application let the cq
+ * ring fill up the event is dropped and accounted in ->overflow.
+ */
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_uring_cqe *cqe;
+	unsigned tail = ctx->cached_cq_tail;
+
+	smp_rmb();
+	if (tail - ACCESS_ONCE(ring->r.head) == ring->ring_entries) {
+		ring->overflow++;
+		return;
+	}
+
+	cqe = &ring->cqes[tail & ctx->cq_mask];
+	cqe->user_data = user_data;
+	cqe->res = res;
+	cqe->flags = 0;
+	ctx->cached_cq_tail++;
+}
+
+static void io_commit_cqring(struct io_ring_ctx *ctx)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+
+	if (ctx->cached_cq_tail != ring->r.tail) {
+		/* the cqe must be visible before the tail that covers it */
+		smp_wmb();
+		ring->r.tail = ctx->cached_cq_tail;
+	}
+}
+
+static void io_cqring_ev_posted(struct io_ring_ctx *ctx)
+{
+	/* order the tail update against the waiters' condition checks */
+	smp_mb();
+	if (waitqueue_active(&ctx->wait))
+		wake_up(&ctx->wait);
+	if (waitqueue_active(&ctx->cq_wait))
+		wake_up_interruptible(&ctx->cq_wait);
+}
+
+static void io_cqring_add_event(struct io_ring_ctx *ctx, u64 user_data,
+				long res)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	io_cqring_fill_event(ctx, user_data, res);
+	io_commit_cqring(ctx);
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	io_cqring_ev_posted(ctx);
+}
+
+static struct io_kiocb *io_get_req(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+	if (!req)
+		return NULL;
+
+	req->ctx = ctx;
+	atomic_set(&req->refs, 1);
+	req->file = NULL;
+	req->flags = 0;
+	INIT_LIST_HEAD(&req->list);
+	atomic_inc(&ctx->inflight);
+	return req;
+}
+
+static void io_put_req(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	if (!atomic_dec_and_test(&req->refs))
+		return;
+	if (req->file && !(req->flags & REQ_F_FIXED_FILE))
+		fput(req->file);
+	kmem_cache_free(req_cachep, req);
+	atomic_dec(&ctx->inflight);
+}
+
+/*
+ * Release the request before posting its cqe: once the application sees
+ * the completion the request no longer holds the ring busy.
+ */
+static void io_complete_req(struct io_kiocb *req, long res)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	u64 user_data = req->sqe.user_data;
+
+	io_put_req(req);
+	io_cqring_add_event(ctx, user_data, res);
+}
+
+static int io_get_file(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+
+	if (sqe->flags & IOSQE_FIXED_FILE) {
+		if (!ctx->user_files || (unsigned) sqe->fd >= ctx->nr_user_files)
+			return -EBADF;
+		req->file = ctx->user_files[sqe->fd];
+		req->flags |= REQ_F_FIXED_FILE;
+		return 0;
+	}
+
+	/* the sq thread has no file table to look fds up in */
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		return -EBADF;
+
+	req->file = fget(sqe->fd);
+	if (!req->file)
+		return -EBADF;
+	return 0;
+}
+
+static int io_prep_fixed(struct io_ring_ctx *ctx,
+			 const struct io_uring_sqe *sqe)
+{
+	struct io_mapped_ubuf *imu;
+	unsigned long addr = sqe->addr;
+	unsigned long end = addr + sqe->len;
+
+	if (!ctx->user_bufs || sqe->buf_index >= ctx->nr_user_bufs)
+		return -EFAULT;
+
+	imu = &ctx->user_bufs[sqe->buf_index];
+	if (end < addr || addr < imu->ubuf || end > imu->ubuf + imu->len)
+		return -EFAULT;
+	return 0;
+}
+
+static long io_do_rw(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	void __user *buf = (void __user *) (unsigned long) sqe->addr;
+	loff_t pos = sqe->off;
+
+	switch (sqe->opcode) {
+	case IORING_OP_READV:
+		return vfs_readv(req->file, buf, sqe->len, &pos);
+	case IORING_OP_WRITEV:
+		return vfs_writev(req->file, buf, sqe->len, &pos);
+	case IORING_OP_READ_FIXED:
+		return vfs_read(req->file, buf, sqe->len, &pos);
+	case IORING_OP_WRITE_FIXED:
+		return vfs_write(req->file, buf, sqe->len, &pos);
+	}
+	return -EINVAL;
+}
+
+static long io_do_fsync(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	loff_t end = sqe->len ? sqe->off + sqe->len - 1 : LLONG_MAX;
+
+	return vfs_fsync_range(req->file, req->file->f_path.dentry, sqe->off,
+			       end, sqe->fsync_flags & IORING_FSYNC_DATASYNC);
+}
+
+/*
+ * A read or write on a pipe or socket can block for as long as the other
+ * end likes, and the ring teardown has to wait for the worker.  While it
+ * runs a request the worker accepts SIGINT, which io_cancel_async_work()
+ * sends to get it out of an interruptible sleep; once the ring is dying,
+ * the requests still queued are failed without being started.
+ */
+static bool io_wq_start(struct io_ring_ctx *ctx)
+{
+	bool dying;
+
+	allow_signal(SIGINT);
+	spin_lock(&ctx->wq_lock);
+	dying = ctx->dying;
+	if (!dying)
+		ctx->wq_task = current;
+	spin_unlock(&ctx->wq_lock);
+	return !dying;
+}
+
+static void io_wq_end(struct io_ring_ctx *ctx)
+{
+	spin_lock(&ctx->wq_lock);
+	ctx->wq_task = NULL;
+	spin_unlock(&ctx->wq_lock);
+	disallow_signal(SIGINT);
+	flush_signals(current);
+}
+
+static void io_cancel_async_work(struct io_ring_ctx *ctx)
+{
+	spin_lock(&ctx->wq_lock);
+	ctx->dying = true;
+	if (ctx->wq_task)
+		send_sig(SIGINT, ctx->wq_task, 1);
+	spin_unlock(&ctx->wq_lock);
+}
+
+/*
+ * Runs a read, write or fsync in a worker, with the creator's address
+ * space (the buffers are user addresses) and credentials.  Kernel
+ * threads run with KERNEL_DS, which use_mm() leaves alone: without
+ * USER_DS, access_ok() would let sqe->addr and the iovecs it points to
+ * reach kernel memory.
+ */
+static void io_sq_wq_submit_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	struct mm_struct *mm = ctx->sqo_mm;
+	const struct cred *old_cred;
+	mm_segment_t oldfs;
+	long ret;
+
+	if (!io_wq_start(ctx)) {
+		io_wq_end(ctx);
+		io_complete_req(req, -ECANCELED);
+		return;
+	}
+
+	old_cred = override_creds(ctx->creds);
+
+	if (req->sqe.opcode == IORING_OP_FSYNC)
+		ret = io_do_fsync(req);
+	else if (!atomic_inc_not_zero(&mm->mm_users))
+		ret = -EFAULT;	/* the creator has exited */
+	else {
+		oldfs = get_fs();
+		set_fs(USER_DS);
+		use_mm(mm);
+		ret = io_do_rw(req);
+		unuse_mm(mm);
+		set_fs(oldfs);
+		mmput(mm);
+	}
+
+	revert_creds(old_cred);
+	io_wq_end(ctx);
+
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+	io_complete_req(req, ret);
+}
+
+/*
+ * Each ring has a single worker thread, so a request that blocks holds up
+ * the rest of its own ring but never anybody else's, and an application
+ * cannot make the kernel spawn more than one thread per ring.
+ */
+static void io_queue_async_work(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	INIT_WORK(&req->work, io_sq_wq_submit_work);
+	queue_work(ctx->sqo_wq, &req->work);
+}
+
+static int io_prep_rw(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+
+	if (sqe->ioprio || sqe->rw_flags)
+		return -EINVAL;
+	if (sqe->opcode == IORING_OP_READ_FIXED ||
+	    sqe->opcode == IORING_OP_WRITE_FIXED)
+		return io_prep_fixed(ctx, sqe);
+	if (sqe->buf_index)
+		return -EINVAL;
+	return 0;
+}
+
+static int io_prep_fsync(struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+
+	if (sqe->addr || sqe->ioprio || sqe->buf_index)
+		return -EINVAL;
+	if (sqe->fsync_flags & ~IORING_FSYNC_DATASYNC)
+		return -EINVAL;
+	return 0;
+}
+
+/*
+ * Poll requests.  An armed request sits on its file's wait queue and on
+ * ctx->cancel_list.  Whoever takes it off the wait queue, under the wait
+ * queue lock, queues req->work exactly once to complete it: the wakeup,
+ * a POLL_REMOVE or the ring teardown.
+ */
+static void io_poll_remove_one(struct io_kiocb *req)
+{
+	struct io_poll_iocb *poll = &req->poll;
+
+	spin_lock(&poll->head->lock);
+	poll->canceled = true;
+	if (!list_empty(&poll->wait.task_list)) {
+		list_del_init(&poll->wait.task_list);
+		queue_work(req->ctx->sqo_wq, &req->work);
+	}
+	spin_unlock(&poll->head->lock);
+
+	list_del_init(&req->list);
+}
+
+static void io_poll_remove_all(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+
+	spin_lock_irq(&ctx->completion_lock);
+	while (!list_empty(&ctx->cancel_list)) {
+		req = list_first_entry(&ctx->cancel_list, struct io_kiocb, list);
+		io_poll_remove_one(req);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static int io_poll_remove(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_kiocb *poll_req, *next;
+	int ret = -ENOENT;
+
+	if (sqe->ioprio || sqe->off || sqe->len || sqe->buf_index ||
+	    sqe->poll_events)
+		return -EINVAL;
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_for_each_entry_safe(poll_req, next, &ctx->cancel_list, list) {
+		if (sqe->addr == poll_req->sqe.user_data) {
+			io_poll_remove_one(poll_req);
+			ret = 0;
+			break;
+		}
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+
+	return ret;
+}
+
+/*
+ * Put a woken request back on its wait queue.  Returns true if it is
+ * armed again and somebody else will complete it, false if completing
+ * it is still up to us.
+ */
+static bool io_poll_rearm(struct io_kiocb *req)
+{
+	struct io_poll_iocb *poll = &req->poll;
+	struct file *file = req->file;
+	bool armed;
+
+	/*
+	 * Once back on the queue the next wakeup can run the work again,
+	 * on another cpu, while we are still looking: hold a reference.
+	 */
+	atomic_inc(&req->refs);
+
+	spin_lock_irq(&poll->head->lock);
+	armed = !poll->canceled;
+	if (armed)
+		__add_wait_queue(poll->head, &poll->wait);
+	spin_unlock_irq(&poll->head->lock);
+
+	/* catch an event that came in while we were off the queue */
+	if (armed && (file->f_op->poll(file, NULL) & poll->events)) {
+		spin_lock_irq(&poll->head->lock);
+		if (!list_empty(&poll->wait.task_list)) {
+			list_del_init(&poll->wait.task_list);
+			armed = false;
+		}
+		spin_unlock_irq(&poll->head->lock);
+	}
+
+	io_put_req(req);
+	return armed;
+}
+
+static void io_poll_complete_work(struct work_struct *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_poll_iocb *poll = &req->poll;
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	unsigned int mask = 0;
+
+	for (;;) {
+		if (poll->canceled)
+			break;
+		mask = file->f_op->poll(file, NULL) & poll->events;
+		if (mask)
+			break;
+		/* spurious, or an event we did not ask for */
+		if (io_poll_rearm(req))
+			return;
+	}
+
+	spin_lock_irq(&ctx->completion_lock);
+	poll->done = true;
+	list_del_init(&req->list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_complete_req(req, mask ? mask : -ECANCELED);
+}
+
+/*
+ * Called with the wait queue lock held, possibly from interrupt context.
+ * Completing means dropping a file reference, which is not safe here, so
+ * leave it to the workqueue.
+ */
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync, void *key)
+{
+	struct io_poll_iocb *poll = container_of(wait, struct io_poll_iocb,
+						 wait);
+	struct io_kiocb *req = container_of(poll, struct io_kiocb, poll);
+	unsigned long mask = (unsigned long) key;
+
+	if (mask && !(mask & poll->events))
+		return 0;
+
+	list_del_init(&poll->wait.task_list);
+	queue_work(req->ctx->sqo_wq, &req->work);
+	return 1;
+}
+
+struct io_poll_table {
+	poll_table		pt;
+	struct io_kiocb		*req;
+	int			error;
+};
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *p)
+{
+	struct io_poll_table *pt = container_of(p, struct io_poll_table, pt);
+	struct io_poll_iocb *poll = &pt->req->poll;
+
+	/* only one wait queue per file is supported */
+	if (poll->head) {
+		pt->error = -EINVAL;
+		return;
+	}
+
+	pt->error = 0;
+	poll->head = head;
+	add_wait_queue(head, &poll->wait);
+}
+
+static int io_poll_add(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_uring_sqe *sqe = &req->sqe;
+	struct io_poll_iocb *poll = &req->poll;
+	struct io_poll_table ipt;
+	unsigned int mask;
+
+	if (sqe->addr || sqe->ioprio || sqe->off || sqe->len || sqe->buf_index)
+		return -EINVAL;
+
+	poll->head = NULL;
+	poll->canceled = false;
+	poll->done = false;
+	poll->events = sqe->poll_events | POLLERR | POLLHUP;
+
+	if (!req->file->f_op->poll) {
+		io_complete_req(req, DEFAULT_POLLMASK & poll->events);
+		return 0;
+	}
+
+	INIT_WORK(&req->work, io_poll_complete_work);
+	INIT_LIST_HEAD(&poll->wait.task_list);
+	init_waitqueue_func_entry(&poll->wait, io_poll_wake);
+
+	init_poll_funcptr(&ipt.pt, io_poll_queue_proc);
+	ipt.pt.key = poll->events;
+	ipt.req = req;
+	ipt.error = -EINVAL;	/* if the file never calls poll_wait() */
+
+	/* a wakeup may complete the request as soon as it is queued */
+	atomic_inc(&req->refs);
+
+	mask = req->file->f_op->poll(req->file, &ipt.pt) & poll->events;
+
+	spin_lock_irq(&ctx->completion_lock);
+	if (poll->head) {
+		spin_lock(&poll->head->lock);
+		if (list_empty(&poll->wait.task_list)) {
+			/* already woken, the work item owns it now */
+			mask = 0;
+			ipt.error = 0;
+		} else if (mask || ipt.error)
+			list_del_init(&poll->wait.task_list);
+		spin_unlock(&poll->head->lock);
+	}
+	if (!mask && !ipt.error && !poll->done)
+		list_add_tail(&req->list, &ctx->cancel_list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	if (mask || ipt.error)
+		io_complete_req(req, mask ? mask : ipt.error);
+	io_put_req(req);
+	return 0;
+}
+
+/*
+ * Take one sqe.  Errors in the sqe itself are reported through its cqe,
+ * only a failure to get a request structure is returned, and leaves the
+ * sqe on the ring.
+ */
+static int io_submit_sqe(struct io_ring_ctx *ctx,
+			 const struct io_uring_sqe *sqe)
+{
+	struct io_kiocb *req;
+	int ret;
+
+	req = io_get_req(ctx);
+	if (!req)
+		return -EAGAIN;
+
+	/* the application can still write the slot, only trust our copy */
+	memcpy(&req->sqe, sqe, sizeof(*sqe));
+	sqe = &req->sqe;
+
+	ret = -EINVAL;
+	if (unlikely(sqe->flags & ~IOSQE_FIXED_FILE))
+		goto err;
+
+	if (sqe->opcode == IORING_OP_NOP) {
+		io_complete_req(req, 0);
+		return 0;
+	}
+	if (sqe->opcode == IORING_OP_POLL_REMOVE) {
+		io_complete_req(req, io_poll_remove(ctx, req));
+		return 0;
+	}
+
+	if (sqe->opcode > IORING_OP_POLL_ADD)
+		goto err;
+
+	ret = io_get_file(ctx, req);
+	if (ret)
+		goto err;
+
+	switch (sqe->opcode) {
+	case IORING_OP_READV:
+	case IORING_OP_WRITEV:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE_FIXED:
+		ret = io_prep_rw(ctx, req);
+		break;
+	case IORING_OP_FSYNC:
+		ret = io_prep_fsync(req);
+		break;
+	case IORING_OP_POLL_ADD:
+		ret = io_poll_add(ctx, req);
+		if (!ret)
+			return 0;
+		goto err;
+	}
+	if (ret)
+		goto err;
+
+	io_queue_async_work(ctx, req);
+	return 0;
+
+err:
+	io_complete_req(req, ret);
+	return 0;
+}
+
+/*
+ * Look at the next sqe without consuming it.  Indices outside the sqe
+ * array are skipped and counted in ->dropped.
+ */
+static const struct io_uring_sqe *io_peek_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned head, idx;
+
+	for (;;) {
+		head = ctx->cached_sq_head;
+		if (head == ACCESS_ONCE(ring->r.tail))
+			return NULL;
+		/* see the sqes the application wrote before the tail */
+		smp_rmb();
+
+		idx = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+		if (likely(idx < ctx->sq_entries))
+			return &ctx->sq_sqes[idx];
+
+		ctx->cached_sq_head++;
+		ring->dropped++;
+	}
+}
+
+static void io_commit_sqring(struct io_ring_ctx *ctx)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+
+	if (ring->r.head != ctx->cached_sq_head) {
+		/* our copies of the sqes are done before the slots go back */
+		smp_mb();
+		ring->r.head = ctx->cached_sq_head;
+	}
+}
+
+/*
+ * Called with ctx->uring_lock held.  Returns the number of sqes consumed,
+ * or -EBUSY if every completion slot is already spoken for.
+ */
+static int io_ring_submit(struct io_ring_ctx *ctx, unsigned int to_submit)
+{
+	const struct io_uring_sqe *sqe;
+	int i, ret = 0;
+
+	for (i = 0; i < to_submit; i++) {
+		if (atomic_read(&ctx->inflight) >= ctx->cq_entries) {
+			ret = -EBUSY;
+			break;
+		}
+		sqe = io_peek_sqring(ctx);
+		if (!sqe)
+			break;
+		ret = io_submit_sqe(ctx, sqe);
+		if (ret)
+			break;
+		ctx->cached_sq_head++;
+	}
+	io_commit_sqring(ctx);
+
+	return i ? i : ret;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	unsigned long timeout = jiffies + ctx->sq_thread_idle;
+	DEFINE_WAIT(wait);
+	int ret;
+
+	/*
+	 * Submission only reads the rings, but nothing the application
+	 * controls may ever be checked against a kernel thread's KERNEL_DS.
+	 */
+	set_fs(USER_DS);
+
+	while (!kthread_should_stop()) {
+		if (!io_sqring_entries(ctx)) {
+			if (time_before(jiffies, timeout)) {
+				cond_resched();
+				continue;
+			}
+
+			prepare_to_wait(&ctx->sqo_wait, &wait,
+					TASK_INTERRUPTIBLE);
+			ctx->sq_ring->flags |= IORING_SQ_NEED_WAKEUP;
+			/* pairs with the application's tail update */
+			smp_mb();
+			if (!io_sqring_entries(ctx) && !kthread_should_stop())
+				schedule();
+			finish_wait(&ctx->sqo_wait, &wait);
+			ctx->sq_ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+			timeout = jiffies + ctx->sq_thread_idle;
+			continue;
+		}
+
+		mutex_lock(&ctx->uring_lock);
+		ret = io_ring_submit(ctx, io_sqring_entries(ctx));
+		mutex_unlock(&ctx->uring_lock);
+
+		if (ret == -EBUSY)
+			wait_event_timeout(ctx->wait,
+				atomic_read(&ctx->inflight) < ctx->cq_entries ||
+				kthread_should_stop(), HZ);
+		else if (ret > 0)
+			timeout = jiffies + ctx->sq_thread_idle;
+		cond_resched();
+	}
+
+	return 0;
+}
+
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned min_events)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	int ret;
+
+	ret = wait_event_interruptible(ctx->wait,
+				       io_cqring_events(ring) >= min_events);
+	if (ret == -ERESTARTSYS)
+		ret = -EINTR;
+	return ret;
+}
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned nr_args)
+{
+	__s32 __user *fds = arg;
+	struct file *file;
+	unsigned i;
+	int ret = 0;
+	__s32 fd;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		ret = -EFAULT;
+		if (get_user(fd, &fds[i]))
+			break;
+		ret = -EBADF;
+		file = fget(fd);
+		if (!file)
+			break;
+		/* the ring would pin itself */
+		if (file->f_op == &io_uring_fops) {
+			fput(file);
+			break;
+		}
+		ctx->user_files[ctx->nr_user_files++] = file;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+	return ret;
+}
+
+/*
+ * Pinned buffer pages are charged to the creator's locked_vm, like
+ * mlock()ed ones, so RLIMIT_MEMLOCK bounds them across all of its rings
+ * and not just per ring.
+ */
+static int io_account_mem(struct mm_struct *mm, unsigned long nr_pages)
+{
+	unsigned long lock_limit;
+	int ret = 0;
+
+	lock_limit = current->signal->rlim[RLIMIT_MEMLOCK].rlim_cur >>
+			PAGE_SHIFT;
+
+	down_write(&mm->mmap_sem);
+	if (mm->locked_vm + nr_pages > lock_limit && !capable(CAP_IPC_LOCK))
+		ret = -ENOMEM;
+	else
+		mm->locked_vm += nr_pages;
+	up_write(&mm->mmap_sem);
+	return ret;
+}
+
+static void io_unaccount_mem(struct mm_struct *mm, unsigned long nr_pages)
+{
+	down_write(&mm->mmap_sem);
+	mm->locked_vm -= nr_pages;
+	up_write(&mm->mmap_sem);
+}
+
+static void io_sqe_buffer_unregister(struct io_ring_ctx *ctx)
+{
+	struct io_mapped_ubuf *imu;
+	unsigned long nr_pages = 0;
+	unsigned i, j;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		imu = &ctx->user_bufs[i];
+		for (j = 0; j < imu->nr_pages; j++)
+			put_page(imu->pages[j]);
+		vfree(imu->pages);
+		nr_pages += imu->nr_pages;
+	}
+	if (nr_pages)
+		io_unaccount_mem(ctx->sqo_mm, nr_pages);
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+}
+
+static int io_sqe_buffer_register(struct io_ring_ctx *ctx, void __user *arg,
+				  unsigned nr_args)
+{
+	struct iovec __user *uiov = arg;
+	struct io_mapped_ubuf *imu;
+	struct iovec iov;
+	unsigned long start, end;
+	int i, pret, ret = 0;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > UIO_MAXIOV)
+		return -EINVAL;
+	/* the workers use them in, and charge them to, the creator's mm */
+	if (current->mm != ctx->sqo_mm)
+		return -EPERM;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		imu = &ctx->user_bufs[i];
+
+		ret = -EFAULT;
+		if (copy_from_user(&iov, &uiov[i], sizeof(iov)))
+			break;
+		ret = -EINVAL;
+		if (!iov.iov_base || !iov.iov_len ||
+		    iov.iov_len > IORING_MAX_BUF_SIZE)
+			break;
+
+		start = (unsigned long) iov.iov_base >> PAGE_SHIFT;
+		end = ((unsigned long) iov.iov_base + iov.iov_len +
+			PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+		ret = io_account_mem(current->mm, end - start);
+		if (ret)
+			break;
+
+		ret = -ENOMEM;
+		imu->pages = vmalloc((end - start) * sizeof(struct page *));
+		if (!imu->pages) {
+			io_unaccount_mem(current->mm, end - start);
+			break;
+		}
+
+		down_read(&current->mm->mmap_sem);
+		pret = get_user_pages(current, current->mm,
+				      (unsigned long) iov.iov_base,
+				      end - start, 1, 0, imu->pages, NULL);
+		up_read(&current->mm->mmap_sem);
+
+		if (pret != end - start) {
+			while (pret > 0)
+				put_page(imu->pages[--pret]);
+			vfree(imu->pages);
+			io_unaccount_mem(current->mm, end - start);
+			ret = pret < 0 ? pret : -EFAULT;
+			break;
+		}
+
+		imu->ubuf = (unsigned long) iov.iov_base;
+		imu->len = iov.iov_len;
+		imu->nr_pages = end - start;
+		ctx->nr_user_bufs++;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_buffer_unregister(ctx);
+	return ret;
+}
+
+static void *io_mem_alloc(size_t size)
+{
+	gfp_t gfp = GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN | __GFP_COMP;
+
+	return (void *) __get_free_pages(gfp, get_order(size));
+}
+
+static void io_mem_free(void *ptr, size_t size)
+{
+	if (ptr)
+		free_pages((unsigned long) ptr, get_order(size));
+}
+
+static size_t io_sq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_sq_ring) + entries * sizeof(u32);
+}
+
+static size_t io_cq_ring_size(unsigned entries)
+{
+	return sizeof(struct io_cq_ring) +
+		entries * sizeof(struct io_uring_cqe);
+}
+
+static size_t io_sqes_size(unsigned entries)
+{
+	return entries * sizeof(struct io_uring_sqe);
+}
+
+static void io_ring_ctx_free(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_thread)
+		kthread_stop(ctx->sqo_thread);
+	io_poll_remove_all(ctx);
+	/* runs the remaining requests, canceled polls included */
+	if (ctx->sqo_wq)
+		destroy_workqueue(ctx->sqo_wq);
+
+	io_sqe_files_unregister(ctx);
+	io_sqe_buffer_unregister(ctx);
+
+	io_mem_free(ctx->sq_ring, io_sq_ring_size(ctx->sq_entries));
+	io_mem_free(ctx->sq_sqes, io_sqes_size(ctx->sq_entries));
+	io_mem_free(ctx->cq_ring, io_cq_ring_size(ctx->cq_entries));
+
+	mmdrop(ctx->sqo_mm);
+	put_cred(ctx->creds);
+	kfree(ctx);
+}
+
+static void io_ring_exit_work(struct work_struct *work)
+{
+	io_ring_ctx_free(container_of(work, struct io_ring_ctx, exit_work));
+}
+
+/*
+ * The ring mapping holds a reference to the file, so the last one can go
+ * away in exit_mmap() under the mmput() of one of our own workers, which
+ * must not wait for itself in destroy_workqueue().  Kick the worker out
+ * of whatever it is blocked on and tear down from io_uring_exit_wq, where
+ * waiting for it holds up no one but other rings going away.
+ */
+static int io_uring_release(struct inode *inode, struct file *file)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+
+	file->private_data = NULL;
+	io_cancel_async_work(ctx);
+	INIT_WORK(&ctx->exit_work, io_ring_exit_work);
+	queue_work(io_uring_exit_wq, &ctx->exit_work);
+	return 0;
+}
+
+static int io_uring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	unsigned long sz = vma->vm_end - vma->vm_start;
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned long pfn;
+	size_t size;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		size = io_sq_ring_size(ctx->sq_entries);
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		size = io_sqes_size(ctx->sq_entries);
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		size = io_cq_ring_size(ctx->cq_entries);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (sz > PAGE_ALIGN(size))
+		return -EINVAL;
+
+	pfn = virt_to_phys(ptr) >> PAGE_SHIFT;
+	return remap_pfn_range(vma, vma->vm_start, pfn, sz, vma->vm_page_prot);
+}
+
+static unsigned int io_uring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	smp_rmb();
+	if (io_sqring_entries(ctx) != ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+	if (io_cqring_events(ctx->cq_ring))
+		mask |= POLLIN | POLLRDNORM;
+
+	return mask;
+}
+
+static const struct file_operations io_uring_fops = {
+	.release	= io_uring_release,
+	.mmap		= io_uring_mmap,
+	.poll		= io_uring_poll,
+};
+
+SYSCALL_DEFINE4(io_uring_enter, unsigned int, fd, unsigned int, to_submit,
+		unsigned int, min_complete, unsigned int, flags)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int submitted = 0;
+	int ret = -EBADF;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+	ret = 0;
+
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		to_submit = min(to_submit, ctx->sq_entries);
+
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_ring_submit(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+
+		if (submitted < 0) {
+			ret = submitted;
+			goto out_fput;
+		}
+	}
+
+	if (flags & IORING_ENTER_GETEVENTS) {
+		min_complete = min(min_complete, ctx->cq_entries);
+		ret = io_cqring_wait(ctx, min_complete);
+	}
+
+out_fput:
+	fput(file);
+	return submitted ? submitted : ret;
+}
+
+static int io_sq_offload_start(struct io_ring_ctx *ctx,
+			       struct io_uring_params *p)
+{
+	int ret;
+
+	ctx->sqo_wq = create_singlethread_workqueue("io_uring");
+	if (!ctx->sqo_wq)
+		return -ENOMEM;
+
+	if (!(ctx->flags & IORING_SETUP_SQPOLL))
+		return 0;
+
+	ctx->sq_thread_idle = msecs_to_jiffies(p->sq_thread_idle);
+	if (!ctx->sq_thread_idle)
+		ctx->sq_thread_idle = HZ;
+
+	ctx->sqo_thread = kthread_create(io_sq_thread, ctx, "io_uring-sq");
+	if (IS_ERR(ctx->sqo_thread)) {
+		ret = PTR_ERR(ctx->sqo_thread);
+		ctx->sqo_thread = NULL;
+		return ret;
+	}
+	if (ctx->flags & IORING_SETUP_SQ_AFF)
+		kthread_bind(ctx->sqo_thread, p->sq_thread_cpu);
+	wake_up_process(ctx->sqo_thread);
+	return 0;
+}
+
+static int io_allocate_scq_urings(struct io_ring_ctx *ctx,
+				  struct io_uring_params *p)
+{
+	/* io_ring_ctx_free() needs the sizes to free a partial setup */
+	ctx->sq_entries = p->sq_entries;
+	ctx->sq_mask = p->sq_entries - 1;
+	ctx->cq_entries = p->cq_entries;
+	ctx->cq_mask = p->cq_entries - 1;
+
+	ctx->sq_ring = io_mem_alloc(io_sq_ring_size(p->sq_entries));
+	ctx->sq_sqes = io_mem_alloc(io_sqes_size(p->sq_entries));
+	ctx->cq_ring = io_mem_alloc(io_cq_ring_size(p->cq_entries));
+	if (!ctx->sq_ring || !ctx->sq_sqes || !ctx->cq_ring)
+		return -ENOMEM;
+
+	ctx->sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_ring->ring_mask = p->sq_entries - 1;
+	ctx->cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_ring->ring_mask = p->cq_entries - 1;
+
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, r.head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, r.tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, r.head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, r.tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+	return 0;
+}
+
+static int io_uring_create(unsigned entries, struct io_uring_params *p,
+			   struct io_uring_params __user *params)
+{
+	struct io_ring_ctx *ctx;
+	int ret;
+
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+
+	/*
+	 * Twice as many cqes as sqes: the sq ring may be refilled before
+	 * the completions of the previous batch have been reaped.
+	 */
+	p->sq_entries = roundup_pow_of_two(entries);
+	p->cq_entries = 2 * p->sq_entries;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ctx->flags = p->flags;
+	init_waitqueue_head(&ctx->sqo_wait);
+	init_waitqueue_head(&ctx->wait);
+	init_waitqueue_head(&ctx->cq_wait);
+	mutex_init(&ctx->uring_lock);
+	spin_lock_init(&ctx->wq_lock);
+	atomic_set(&ctx->inflight, 0);
+	spin_lock_init(&ctx->completion_lock);
+	INIT_LIST_HEAD(&ctx->cancel_list);
+
+	/*
+	 * Only pin the mm_struct, not the address space: the ring mapping
+	 * would otherwise keep the address space alive and with it the ring.
+	 */
+	ctx->sqo_mm = current->mm;
+	atomic_inc(&ctx->sqo_mm->mm_count);
+	ctx->creds = get_current_cred();
+
+	ret = io_allocate_scq_urings(ctx, p);
+	if (ret)
+		goto err;
+
+	ret = io_sq_offload_start(ctx, p);
+	if (ret)
+		goto err;
+
+	ret = -EFAULT;
+	if (copy_to_user(params, p, sizeof(*p)))
+		goto err;
+
+	ret = anon_inode_getfd("[io_uring]", &io_uring_fops, ctx, O_RDWR);
+	if (ret < 0)
+		goto err;
+	return ret;
+
+err:
+	io_ring_ctx_free(ctx);
+	return ret;
+}
+
+SYSCALL_DEFINE2(io_uring_setup, unsigned int, entries,
+		struct io_uring_params __user *, params)
+{
+	struct io_uring_params p;
+	int i;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	for (i = 0; i < ARRAY_SIZE(p.resv); i++) {
+		if (p.resv[i])
+			return -EINVAL;
+	}
+
+	if (p.flags & ~(IORING_SETUP_SQPOLL | IORING_SETUP_SQ_AFF))
+		return -EINVAL;
+	if (p.flags & IORING_SETUP_SQPOLL) {
+		/* a polling thread burns a cpu on the caller's behalf */
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+	} else if (p.flags & IORING_SETUP_SQ_AFF)
+		return -EINVAL;
+	if (p.flags & IORING_SETUP_SQ_AFF) {
+		if (p.sq_thread_cpu >= nr_cpu_ids ||
+		    !cpu_online(p.sq_thread_cpu))
+			return -EINVAL;
+	}
+
+	return io_uring_create(entries, &p, params);
+}
+
+SYSCALL_DEFINE4(io_uring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int ret;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_uring_fops)
+		goto out_fput;
+
+	ctx = file->private_data;
+
+	mutex_lock(&ctx->uring_lock);
+
+	/* requests in flight may be using what we are about to change */
+	ret = -EBUSY;
+	if (atomic_read(&ctx->inflight))
+		goto out_unlock;
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffer_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_bufs)
+			break;
+		io_sqe_buffer_unregister(ctx);
+		ret = 0;
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -EINVAL;
+		if (arg || nr_args)
+			break;
+		ret = -ENXIO;
+		if (!ctx->user_files)
+			break;
+		io_sqe_files_unregister(ctx);
+		ret = 0;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+out_unlock:
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fput(file);
+	return ret;
+}
+
+static int __init io_uring_init(void)
+{
+	req_cachep = KMEM_CACHE(io_kiocb, SLAB_HWCACHE_ALIGN | SLAB_PANIC);
+	io_uring_exit_wq = create_singlethread_workqueue("io_uring_exit");
+	BUG_ON(!io_uring_exit_wq);
+	return 0;
+}
+__initcall(io_uring_init);
@@ -687,15 +687,15 @@ int follow_up(struct path *path)
 {
 	struct vfsmount *parent;
 	struct dentry *mountpoint;
-	spin_lock(&vfsmount_lock);
+	br_read_lock(vfsmount_lock);
 	parent = path->mnt->mnt_parent;
 	if (parent == path->mnt) {
-		spin_unlock(&vfsmount_lock);
+		br_read_unlock(vfsmount_lock);
 		return 0;
 	}
 	mntget(parent);
 	mountpoint = dget(path->mnt->mnt_mountpoint);
-	spin_unlock(&vfsmount_lock);
+	br_read_unlock(vfsmount_lock);
 	dput(path->dentry);
 	path->dentry = mountpoint;
 	mntput(path->mnt);
@@ -774,15 +774,15 @@ static __always_inline void follow_dotdot(struct nameidata *nd)
 			break;
 		}
 		spin_unlock(&dcache_lock);
-		spin_lock(&vfsmount_lock);
+		br_read_lock(vfsmount_lock);
 		parent = nd->path.mnt->mnt_parent;
 		if (parent == nd->path.mnt) {
-			spin_unlock(&vfsmount_lock);
+			br_read_unlock(vfsmount_lock);
 			break;
 		}
 		mntget(parent);
 		nd->path.dentry = dget(nd->path.mnt->mnt_mountpoint);
-		spin_unlock(&vfsmount_lock);
+		br_read_unlock(vfsmount_lock);
 		dput(old);
 		mntput(nd->path.mnt);
 		nd->path.mnt = parent;
@@ -829,6 +829,147 @@ fail:
 	return PTR_ERR(dentry);
 }
 
+#ifndef CONFIG_DEBUG_PAGEALLOC
+/*
+ * MAY_EXEC check for a directory rcu-walk has not pinned.  Only the mode
+ * bits are looked at; ACLs, CAP_DAC_* and the security hook are left to
+ * exec_permission_lite() in ref-walk.
+ */
+static int exec_permission_rcu(struct dentry *dentry, struct inode *inode)
+{
+	umode_t mode = inode->i_mode;
+
+	if (!(dentry->d_flags & DCACHE_RCUWALK_DIR))
+		return -ECHILD;
+	if (current_fsuid() == inode->i_uid)
+		mode >>= 6;
+	else {
+		if ((dentry->d_sb->s_flags & MS_POSIXACL) && (mode & S_IRWXG))
+			return -ECHILD;
+		if (in_group_p(inode->i_gid))
+			mode >>= 3;
+	}
+	return (mode & MAY_EXEC) ? 0 : -EACCES;
+}
+
+/*
+ * rcu-walk: resolve the leading components of a path straight from the
+ * dcache, without taking a reference or a lock on the dentries passed.
+ *
+ * Every dentry has a sequence count, d_seq, that is bumped when its name,
+ * parent or inode changes.  We sample it when a dentry is found and check
+ * it again once its child has been found, so each step is known to have
+ * been valid.  Only the directory we stop at is pinned, and the reference
+ * on the one we started from is dropped.
+ *
+ * Anything beyond a plain hash lookup ends the walk: "..", mount points,
+ * symlinks, d_revalidate/d_hash/d_compare, ACLs, a cache miss, a failed
+ * permission check and the last component.  Ref-walk then carries on
+ * from the directory reached.  If a sequence check fails, the name is
+ * returned untouched and ref-walk does the whole path.
+ *
+ * Inodes are not pinned either.  We only load i_mode, i_uid and i_gid
+ * and drop the values if d_seq shows the inode was detached meanwhile.
+ * Freed inodes may be unmapped under DEBUG_PAGEALLOC, so rcu-walk is
+ * compiled out there.
+ */
+static const char *rcu_walk(const char *name, struct nameidata *nd)
+{
+	struct dentry *parent = nd->path.dentry;
+	const char *done = name;
+	unsigned seq;
+
+	if (!security_inode_permission_is_default())
+		return name;
+
+	rcu_read_lock();
+	seq = read_seqcount_begin(&parent->d_seq);
+	for (;;) {
+		struct inode *inode = parent->d_inode;
+		struct dentry *dentry;
+		struct qstr this;
+		unsigned long hash;
+		const char *p;
+		unsigned int c;
+		unsigned dseq;
+
+		if (!inode || exec_permission_rcu(parent, inode))
+			break;
+
+		p = done;
+		this.name = (const unsigned char *)p;
+		c = *(const unsigned char *)p;
+		hash = init_name_hash();
+		do {
+			p++;
+			hash = partial_name_hash(c, hash);
+			c = *(const unsigned char *)p;
+		} while (c && (c != '/'));
+		this.len = p - (const char *) this.name;
+		this.hash = end_name_hash(hash);
+
+		/* the last component is left to ref-walk */
+		if (!c)
+			break;
+		while (*++p == '/');
+		if (!*p)
+			break;
+
+		if (this.name[0] == '.') {
+			if (this.len == 1) {
+				done = p;
+				continue;
+			}
+			if (this.len == 2 && this.name[1] == '.')
+				break;
+		}
+		if (parent->d_op &&
+		    (parent->d_op->d_hash || parent->d_op->d_compare))
+			break;
+
+		dentry = __d_lookup_rcu(parent, &this, &dseq);
+		if (!dentry)
+			break;
+		if (read_seqcount_retry(&parent->d_seq, seq))
+			goto fail;
+		if (!dentry->d_inode || d_mountpoint(dentry) ||
+		    !(dentry->d_flags & DCACHE_RCUWALK_DIR) ||
+		    (dentry->d_op && dentry->d_op->d_revalidate))
+			break;
+
+		parent = dentry;
+		seq = dseq;
+		done = p;
+	}
+
+	if (parent != nd->path.dentry) {
+		spin_lock(&parent->d_lock);
+		if (d_unhashed(parent) ||
+		    read_seqcount_retry(&parent->d_seq, seq)) {
+			spin_unlock(&parent->d_lock);
+			goto fail;
+		}
+		atomic_inc(&parent->d_count);
+		spin_unlock(&parent->d_lock);
+		rcu_read_unlock();
+		dput(nd->path.dentry);
+		nd->path.dentry = parent;
+		return done;
+	}
+	rcu_read_unlock();
+	return done;
+
+fail:
+	rcu_read_unlock();
+	return name;
+}
+#else
+static inline const char *rcu_walk(const char *name, struct nameidata *nd)
+{
+	return name;
+}
+#endif
+
 /*
  * This is a temporary kludge to deal with "automount" symlinks; proper
  * solution is to trigger them on follow_mount(), so that do_lookup()
@@ -860,6 +1001,7 @@ static int __link_path_walk(const char *name, struct nameidata *nd)
 	if (!*name)
 		goto return_reval;
 
+	name = rcu_walk(name, nd);
 	inode = nd->path.dentry->d_inode;
 	if (nd->depth)
 		lookup_flags = LOOKUP_FOLLOW | (nd->flags & LOOKUP_CONTINUE);
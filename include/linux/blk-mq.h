@@ -0,0 +1,125 @@
+#ifndef BLK_MQ_H
+#define BLK_MQ_H
+
+#include <linux/blkdev.h>
+
+struct blk_mq_tags;
+
+/*
+ * Software queue: one per cpu and queue.  Submitters only ever touch the
+ * context of the cpu they run on, so its lock is practically uncontended.
+ */
+struct blk_mq_ctx {
+	spinlock_t		lock;
+	struct list_head	rq_list;
+
+	unsigned int		cpu;
+	unsigned int		index_hw;	/* bit in hctx->ctx_map */
+	unsigned int		last_tag;	/* tag allocation hint */
+
+	struct request_queue	*queue;
+} ____cacheline_aligned_in_smp;
+
+/*
+ * Hardware dispatch context: one per submission queue of the device.
+ * Several software queues feed into each of them.
+ */
+struct blk_mq_hw_ctx {
+	struct {
+		spinlock_t		lock;
+		struct list_head	dispatch;	/* bounced by ->queue_rq */
+	} ____cacheline_aligned_in_smp;
+
+	unsigned long		state;		/* BLK_MQ_S_* flags */
+	struct work_struct	run_work;
+
+	struct request_queue	*queue;
+	unsigned int		queue_num;
+	void			*driver_data;
+
+	unsigned int		nr_ctx;
+	struct blk_mq_ctx	**ctxs;
+	unsigned long		*ctx_map;	/* ctxs with pending requests */
+
+	struct blk_mq_tags	*tags;
+	unsigned int		queue_depth;
+	int			numa_node;
+};
+
+typedef int (queue_rq_fn)(struct blk_mq_hw_ctx *, struct request *);
+typedef struct blk_mq_hw_ctx *(map_queue_fn)(struct request_queue *, const int);
+
+struct blk_mq_ops {
+	/*
+	 * Start a request.  Called in process context, may block.
+	 */
+	queue_rq_fn		*queue_rq;
+
+	/*
+	 * Map a cpu to its hardware context, usually blk_mq_map_queue.
+	 */
+	map_queue_fn		*map_queue;
+
+	/*
+	 * Finish a request passed to blk_mq_complete_request(), called from
+	 * softirq context on the cpu that submitted it.
+	 */
+	softirq_done_fn		*complete;
+};
+
+struct blk_mq_reg {
+	struct blk_mq_ops	*ops;
+	unsigned int		nr_hw_queues;
+	unsigned int		queue_depth;	/* tags per hardware queue */
+	unsigned int		cmd_size;	/* per-request driver data */
+	int			numa_node;
+};
+
+enum {
+	BLK_MQ_RQ_QUEUE_OK	= 0,	/* request queued to the device */
+	BLK_MQ_RQ_QUEUE_BUSY	= 1,	/* device full, queue stopped */
+	BLK_MQ_RQ_QUEUE_ERROR	= 2,	/* fail the request with -EIO */
+
+	BLK_MQ_S_STOPPED	= 0,
+
+	BLK_MQ_MAX_DEPTH	= 2048,
+};
+
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *, void *);
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *, const int);
+
+struct request *blk_mq_alloc_request(struct request_queue *, int, gfp_t);
+void blk_mq_free_request(struct request *);
+void blk_mq_insert_request(struct request *, bool, bool, bool);
+
+void blk_mq_end_io(struct request *, int);
+void blk_mq_complete_request(struct request *);
+
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *, bool);
+void blk_mq_run_queues(struct request_queue *, bool);
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *);
+void blk_mq_start_hw_queue(struct blk_mq_hw_ctx *);
+void blk_mq_start_stopped_hw_queues(struct request_queue *, bool);
+
+/*
+ * Driver data of a request: cmd_size bytes allocated right behind it.
+ */
+static inline void *blk_mq_rq_to_pdu(struct request *rq)
+{
+	return (void *) rq + sizeof(*rq);
+}
+
+static inline struct request *blk_mq_rq_from_pdu(void *pdu)
+{
+	return pdu - sizeof(struct request);
+}
+
+#define queue_for_each_hw_ctx(q, hctx, i)				\
+	for ((i) = 0; (i) < (q)->nr_hw_queues &&			\
+	     ({ hctx = (q)->queue_hw_ctx[i]; 1; }); (i)++)
+
+#define hctx_for_each_ctx(hctx, ctx, i)					\
+	for ((i) = 0; (i) < (hctx)->nr_ctx &&				\
+	     ({ ctx = (hctx)->ctxs[(i)]; 1; }); (i)++)
+
+#endif
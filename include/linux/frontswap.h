@@ -0,0 +1,99 @@
+#ifndef _LINUX_FRONTSWAP_H
+#define _LINUX_FRONTSWAP_H
+
+#include <linux/swap.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+
+/*
+ * Frontswap: a synchronous, page-granular store that sits in front of the
+ * swap devices.  swap_writepage() offers every page to the backend before
+ * building a bio, swap_readpage() asks the backend first, and the backend
+ * is told when a swap slot is freed.  See Documentation/vm/zswap.txt.
+ *
+ * A backend that accepts a page keeps it until invalidated; one that
+ * wants to give a page back to the real device must go through
+ * frontswap_invalidate_page() and __swap_writepage().
+ */
+struct frontswap_ops {
+	void (*init)(unsigned type);
+	int (*store)(unsigned type, pgoff_t offset, struct page *page);
+	int (*load)(unsigned type, pgoff_t offset, struct page *page);
+	void (*invalidate_page)(unsigned type, pgoff_t offset);
+	void (*invalidate_area)(unsigned type);
+};
+
+#ifdef CONFIG_FRONTSWAP
+extern bool frontswap_enabled;
+extern struct frontswap_ops
+	frontswap_register_ops(struct frontswap_ops *ops);
+
+extern void __frontswap_init(unsigned type);
+extern int __frontswap_store(struct page *page);
+extern int __frontswap_load(struct page *page);
+extern void __frontswap_invalidate_page(unsigned type, pgoff_t offset);
+extern void __frontswap_invalidate_area(unsigned type);
+
+static inline bool frontswap_test(struct swap_info_struct *sis, pgoff_t offset)
+{
+	return sis->frontswap_map && test_bit(offset, sis->frontswap_map);
+}
+
+static inline void frontswap_init(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_init(type);
+}
+
+static inline int frontswap_store(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_store(page);
+	return -1;
+}
+
+static inline int frontswap_load(struct page *page)
+{
+	if (frontswap_enabled)
+		return __frontswap_load(page);
+	return -1;
+}
+
+static inline void frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_page(type, offset);
+}
+
+static inline void frontswap_invalidate_area(unsigned type)
+{
+	if (frontswap_enabled)
+		__frontswap_invalidate_area(type);
+}
+#else /* CONFIG_FRONTSWAP */
+#define frontswap_enabled (0)
+
+static inline void frontswap_init(unsigned type)
+{
+}
+
+static inline int frontswap_store(struct page *page)
+{
+	return -1;
+}
+
+static inline int frontswap_load(struct page *page)
+{
+	return -1;
+}
+
+static inline void frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+}
+
+static inline void frontswap_invalidate_area(unsigned type)
+{
+}
+#endif /* CONFIG_FRONTSWAP */
+
+#endif /* _LINUX_FRONTSWAP_H */
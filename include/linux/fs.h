@@ -726,6 +726,7 @@ struct inode {
 	struct list_head	i_list;		/* backing dev IO list 
 						 * 用于链接描述inode当前状态的链表
 						 */
+	struct list_head	i_lru;		/* inode_unused LRU */
 	struct list_head	i_sb_list;	/*用于链接到超级块中的inode链表*/
 	struct list_head	i_dentry;	/*由于一个文件对应多个dentry，这些dentry都要链接到i_dentry这个链表头*/
 	unsigned long		i_ino;		/*是inode的号*/
@@ -922,6 +923,9 @@ struct file {
 		struct list_head	fu_list;
 		struct rcu_head 	fu_rcuhead;
 	} f_u;
+#ifdef CONFIG_SMP
+	int			f_sb_list_cpu;	/* which s_files list fu_list is on */
+#endif
 	struct path		f_path;
 #define f_dentry	f_path.dentry	/*文件对应的dentry结构*/
 #define f_vfsmnt	f_path.mnt	/*文件所属于的文件系统的vfsmount对象*/
@@ -956,10 +960,6 @@ struct file {
 	unsigned long f_mnt_write_state;
 #endif
 };
-extern spinlock_t files_lock;
-#define file_list_lock() spin_lock(&files_lock);
-#define file_list_unlock() spin_unlock(&files_lock);
-
 #define get_file(x)	atomic_long_inc(&(x)->f_count)
 #define file_count(x)	atomic_long_read(&(x)->f_count)
 
@@ -1356,8 +1356,13 @@ struct super_block {
 
 	struct list_head	s_inodes;	/*指向文件系统内所有的inode,通过它可以遍历inode对象。 all inodes */
 	struct hlist_head	s_anon;		/* anonymous dentries for (nfs) exporting */
+#ifdef CONFIG_SMP
+	struct list_head	*s_files;	/* per-cpu, under files_lglock */
+#else
 	struct list_head	s_files;
-	/* s_dentry_lru and s_nr_dentry_unused are protected by dcache_lock */
+#endif
+	/* s_dentry_lru and s_nr_dentry_unused are protected by s_dentry_lru_lock */
+	spinlock_t		s_dentry_lru_lock;
 	struct list_head	s_dentry_lru;	/* unused dentry lru */
 	int			s_nr_dentry_unused;	/* # of dentry on lru */
 
@@ -2230,8 +2235,8 @@ static inline void insert_inode_hash(struct inode *inode) {
 }
 
 extern struct file * get_empty_filp(void);
-extern void file_move(struct file *f, struct list_head *list);
-extern void file_kill(struct file *f);
+extern void file_sb_list_add(struct file *f, struct super_block *sb);
+extern void file_sb_list_del(struct file *f);
 #ifdef CONFIG_BLOCK
 struct bio;
 extern void submit_bio(int, struct bio *);
@@ -2518,6 +2523,8 @@ ssize_t simple_attr_write(struct file *file, const char __user *buf,
 struct ctl_table;
 int proc_nr_files(struct ctl_table *table, int write,
 		  void __user *buffer, size_t *lenp, loff_t *ppos);
+int proc_nr_dentry(struct ctl_table *table, int write,
+		  void __user *buffer, size_t *lenp, loff_t *ppos);
 
 int __init get_filesystem_list(char *buf);
 
@@ -0,0 +1,162 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent hugepages: anonymous memory mapped by a single pmd.
+ *
+ * Only the paths that know about them (the fault path, zap, follow_page,
+ * khugepaged) deal with huge pmds directly; everything else that walks
+ * page tables calls split_huge_page_pmd() first and then sees ordinary
+ * ptes.  See Documentation/vm/transhuge.txt.
+ */
+
+struct mmu_gather;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+#define HPAGE_PMD_SHIFT PMD_SHIFT
+#define HPAGE_PMD_SIZE	((1UL) << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK	(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER (HPAGE_PMD_SHIFT-PAGE_SHIFT)
+#define HPAGE_PMD_NR (1<<HPAGE_PMD_ORDER)
+
+enum transparent_hugepage_flag {
+	TRANSPARENT_HUGEPAGE_FLAG,
+	TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+	TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG,
+};
+
+extern unsigned long transparent_hugepage_flags;
+
+/*
+ * May a huge page be used to back this vma?  Only private anonymous
+ * memory qualifies; the policy comes from
+ * /sys/kernel/mm/transparent_hugepage/enabled and madvise().
+ */
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_NOHUGEPAGE)
+		return 0;
+	if (!test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags) &&
+	    !(test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+		       &transparent_hugepage_flags) &&
+	      (vma->vm_flags & VM_HUGEPAGE)))
+		return 0;
+	if (vma->vm_ops || vma->vm_file)
+		return 0;
+	if (vma->vm_flags & (VM_SHARED | VM_MAYSHARE | VM_LOCKED | VM_HUGETLB |
+			     VM_SPECIAL | VM_MIXEDMAP | VM_INSERTPAGE))
+		return 0;
+	return 1;
+}
+
+extern int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+				      struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd,
+				      unsigned int flags);
+extern struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+					  unsigned long address, pmd_t *pmd,
+					  unsigned int flags);
+extern int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+			pmd_t *pmd);
+
+extern void __split_huge_page_pmd(struct vm_area_struct *vma,
+				  unsigned long address, pmd_t *pmd);
+extern void split_huge_page_pmd_mm(struct mm_struct *mm, unsigned long address,
+				   pmd_t *pmd);
+extern void split_huge_page(struct page *page);
+
+#define split_huge_page_pmd(__vma, __address, __pmd)			\
+	do {								\
+		pmd_t *____pmd = (__pmd);				\
+		if (unlikely(pmd_trans_huge(*____pmd)))			\
+			__split_huge_page_pmd(__vma, __address,		\
+					      ____pmd);			\
+	} while (0)
+
+extern void __vma_adjust_trans_huge(struct vm_area_struct *vma,
+				    unsigned long start,
+				    unsigned long end,
+				    long adjust_next);
+
+/*
+ * vma_adjust() is about to move a vma boundary: a huge pmd must not
+ * end up straddling two vmas, so split the ones crossing the new edges.
+ */
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+	if (!vma->anon_vma || vma->vm_ops || vma->vm_file)
+		return;
+	__vma_adjust_trans_huge(vma, start, end, adjust_next);
+}
+
+extern int hugepage_madvise(struct vm_area_struct *vma,
+			    unsigned long *vm_flags, int advice);
+
+#else /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define HPAGE_PMD_SHIFT ({ BUG(); 0; })
+#define HPAGE_PMD_MASK ({ BUG(); 0; })
+#define HPAGE_PMD_SIZE ({ BUG(); 0; })
+#define HPAGE_PMD_ORDER ({ BUG(); 0; })
+#define HPAGE_PMD_NR ({ BUG(); 0; })
+
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	return 0;
+}
+
+static inline int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+					     struct vm_area_struct *vma,
+					     unsigned long address, pmd_t *pmd,
+					     unsigned int flags)
+{
+	return VM_FAULT_FALLBACK;
+}
+
+static inline struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+						 unsigned long address,
+						 pmd_t *pmd, unsigned int flags)
+{
+	BUG();
+	return NULL;
+}
+
+static inline int zap_huge_pmd(struct mmu_gather *tlb,
+			       struct vm_area_struct *vma, pmd_t *pmd)
+{
+	return 0;
+}
+
+#define split_huge_page_pmd(__vma, __address, __pmd)	do { } while (0)
+
+static inline void split_huge_page_pmd_mm(struct mm_struct *mm,
+					  unsigned long address, pmd_t *pmd)
+{
+}
+
+static inline void split_huge_page(struct page *page)
+{
+}
+
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+}
+
+static inline int hugepage_madvise(struct vm_area_struct *vma,
+				   unsigned long *vm_flags, int advice)
+{
+	BUG();
+	return 0;
+}
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
@@ -0,0 +1,138 @@
+/*
+ * include/linux/io_uring.h
+ *
+ * Header file for the io_uring submission and completion rings, see
+ * fs/io_uring.c.
+ */
+#ifndef _LINUX_IO_URING_H
+#define _LINUX_IO_URING_H
+
+#include <linux/types.h>
+
+/*
+ * Submission queue entry, the application fills these in the sqes array
+ * and publishes their index through the sq ring.
+ */
+struct io_uring_sqe {
+	__u8	opcode;		/* IORING_OP_* */
+	__u8	flags;		/* IOSQE_* */
+	__u16	ioprio;		/* reserved, must be zero */
+	__s32	fd;		/* file descriptor, or fixed file index */
+	__u64	off;		/* file offset */
+	__u64	addr;		/* buffer, iovec array or poll user_data */
+	__u32	len;		/* buffer size or number of iovecs */
+	union {
+		__u32	rw_flags;	/* reserved, must be zero */
+		__u32	fsync_flags;	/* IORING_FSYNC_* */
+		__u16	poll_events;	/* POLL* mask */
+	};
+	__u64	user_data;	/* passed back in the cqe */
+	union {
+		__u16	buf_index;	/* fixed buffer index */
+		__u64	__pad2[3];
+	};
+};
+
+/*
+ * sqe->flags
+ */
+#define IOSQE_FIXED_FILE	(1U << 0)	/* sqe->fd is a registered file index */
+
+/*
+ * io_uring_setup() flags
+ */
+#define IORING_SETUP_SQPOLL	(1U << 0)	/* a kernel thread polls the sq ring */
+#define IORING_SETUP_SQ_AFF	(1U << 1)	/* bind it to sq_thread_cpu */
+
+#define IORING_OP_NOP		0
+#define IORING_OP_READV		1
+#define IORING_OP_WRITEV	2
+#define IORING_OP_FSYNC		3
+#define IORING_OP_READ_FIXED	4
+#define IORING_OP_WRITE_FIXED	5
+#define IORING_OP_POLL_ADD	6
+#define IORING_OP_POLL_REMOVE	7
+
+/*
+ * sqe->fsync_flags
+ */
+#define IORING_FSYNC_DATASYNC	(1U << 0)
+
+/*
+ * Completion queue entry
+ */
+struct io_uring_cqe {
+	__u64	user_data;	/* sqe->user_data */
+	__s32	res;		/* result, or -errno */
+	__u32	flags;
+};
+
+/*
+ * mmap() offsets of the io_uring file
+ */
+#define IORING_OFF_SQ_RING		0ULL
+#define IORING_OFF_CQ_RING		0x8000000ULL
+#define IORING_OFF_SQES			0x10000000ULL
+
+/*
+ * Offsets of the sq ring fields from the start of its mapping
+ */
+struct io_sqring_offsets {
+	__u32 head;
+	__u32 tail;
+	__u32 ring_mask;
+	__u32 ring_entries;
+	__u32 flags;
+	__u32 dropped;
+	__u32 array;
+	__u32 resv1;
+	__u64 resv2;
+};
+
+/*
+ * sq_ring->flags
+ */
+#define IORING_SQ_NEED_WAKEUP	(1U << 0)	/* the sq thread went to sleep */
+
+/*
+ * Offsets of the cq ring fields from the start of its mapping
+ */
+struct io_cqring_offsets {
+	__u32 head;
+	__u32 tail;
+	__u32 ring_mask;
+	__u32 ring_entries;
+	__u32 overflow;
+	__u32 cqes;
+	__u64 resv[2];
+};
+
+/*
+ * io_uring_enter() flags
+ */
+#define IORING_ENTER_GETEVENTS	(1U << 0)
+#define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+
+/*
+ * Passed in for io_uring_setup(2), filled in by the kernel
+ */
+struct io_uring_params {
+	__u32 sq_entries;
+	__u32 cq_entries;
+	__u32 flags;
+	__u32 sq_thread_cpu;
+	__u32 sq_thread_idle;	/* msecs the sq thread polls before sleeping */
+	__u32 resv[5];
+	struct io_sqring_offsets sq_off;
+	struct io_cqring_offsets cq_off;
+};
+
+/*
+ * io_uring_register() opcodes
+ */
+#define IORING_REGISTER_BUFFERS		0
+#define IORING_UNREGISTER_BUFFERS	1
+#define IORING_REGISTER_FILES		2
+#define IORING_UNREGISTER_FILES		3
+
+#endif /* _LINUX_IO_URING_H */
@@ -104,6 +104,7 @@ enum zone_stat_item {
 	NR_ISOLATED_ANON,	/* Temporary isolated pages from anon lru */
 	NR_ISOLATED_FILE,	/* Temporary isolated pages from file lru */
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
+	NR_ANON_TRANSPARENT_HUGEPAGES,
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -111,6 +112,14 @@ enum zone_stat_item {
 	NUMA_INTERLEAVE_HIT,	/* interleaver preferred this zone */
 	NUMA_LOCAL,		/* allocation from local node */
 	NUMA_OTHER,		/* allocation from other node */
+#endif
+#ifdef CONFIG_COMPACTION
+	COMPACT_BLOCKS_MOVED,	/* pageblocks scanned by the migrate scanner */
+	COMPACT_PAGES_MOVED,	/* pages migrated by compaction */
+	COMPACT_PAGEMIGRATE_FAILED,
+	COMPACT_STALL,		/* direct compactions, charged to the */
+	COMPACT_FAIL,		/*   preferred zone of the allocation */
+	COMPACT_SUCCESS,
 #endif
 	NR_VM_ZONE_STAT_ITEMS };
 
@@ -351,6 +360,15 @@ struct zone {
 	unsigned long		*pageblock_flags;
 #endif /* CONFIG_SPARSEMEM */
 
+#ifdef CONFIG_COMPACTION
+	/*
+	 * On compaction failure, 1<<compact_defer_shift compactions
+	 * are skipped before trying again. The number attempted since
+	 * last failure is tracked with compact_considered.
+	 */
+	unsigned int		compact_considered;
+	unsigned int		compact_defer_shift;
+#endif
 
 	ZONE_PADDING(_pad1_)
 
@@ -70,6 +70,10 @@ void page_add_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void page_add_new_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
 void page_add_file_rmap(struct page *);
 void page_remove_rmap(struct page *);
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+void hugepage_add_new_anon_rmap(struct page *, struct vm_area_struct *, unsigned long);
+void hugepage_remove_rmap(struct page *);
+#endif
 
 static inline void page_dup_rmap(struct page *page)
 {
@@ -243,6 +243,12 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* The packet is carried in a GRE or IPIP tunnel; the outer
+	 * headers are replicated in front of every inner segment. */
+	SKB_GSO_GRE = 1 << 6,
+
+	SKB_GSO_IPIP = 1 << 7,
 };
 
 #if BITS_PER_LONG > 32
@@ -300,6 +306,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@nfct_reasm: netfilter conntrack re-assembly pointer
  *	@nf_bridge: Saved data about a bridged frame - see br_netfilter.c
  *	@iif: ifindex of device we arrived on
+ *	@rxhash: the packet hash computed on receive
  *	@queue_mapping: Queue mapping for multiqueue devices
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
@@ -367,6 +374,7 @@ struct sk_buff {
 #endif
 
 	int			iif;
+	__u32			rxhash;
 #ifdef CONFIG_NET_SCHED
 	__u16			tc_index;	/* traffic control index */
 #ifdef CONFIG_NET_CLS_ACT
@@ -2058,6 +2066,15 @@ static inline bool skb_rx_queue_recorded(const struct sk_buff *skb)
 	return (skb->queue_mapping != 0);
 }
 
+extern __u32 __skb_get_rxhash(struct sk_buff *skb);
+static inline __u32 skb_get_rxhash(struct sk_buff *skb)
+{
+	if (!skb->rxhash)
+		skb->rxhash = __skb_get_rxhash(skb);
+
+	return skb->rxhash;
+}
+
 extern u16 skb_tx_hash(const struct net_device *dev,
 		       const struct sk_buff *skb);
 
@@ -345,7 +345,8 @@ enum ip_defrag_users
 	IP_DEFRAG_CONNTRACK_BRIDGE_IN,
 	IP_DEFRAG_VS_IN,
 	IP_DEFRAG_VS_OUT,
-	IP_DEFRAG_VS_FWD
+	IP_DEFRAG_VS_FWD,
+	IP_DEFRAG_AF_PACKET
 };
 
 int ip_defrag(struct sk_buff *skb, u32 user);
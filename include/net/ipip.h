@@ -34,12 +34,30 @@ struct ip_tunnel_prl_entry
 	u16				flags;
 };
 
+extern struct sk_buff *ip_tunnel_gso_segment(struct sk_buff *skb, int features,
+					     unsigned int hlen, __be16 type);
+extern struct sk_buff **ip_tunnel_gro_receive(struct sk_buff **head,
+					      struct sk_buff *skb,
+					      unsigned int hlen, __be16 type);
+extern int ip_tunnel_gro_complete(struct sk_buff *skb, int nhoff, __be16 type);
+
+/* Reserves an IP id for every segment of a GSO skb.  gso_segs is not
+ * set on skbs built by GRO or coming from untrusted sources, so it is
+ * then estimated from gso_size, counting the inner headers as payload:
+ * reserving an id too many is harmless, one too few is not.
+ */
 #define IPTUNNEL_XMIT() do {						\
 	int err;							\
 	int pkt_len = skb->len - skb_transport_offset(skb);		\
+	int segs = 1;							\
 									\
-	skb->ip_summed = CHECKSUM_NONE;					\
-	ip_select_ident(iph, &rt->u.dst, NULL);				\
+	if (!skb_is_gso(skb))						\
+		skb->ip_summed = CHECKSUM_NONE;				\
+	else								\
+		segs = skb_shinfo(skb)->gso_segs ? :			\
+		       DIV_ROUND_UP(pkt_len,				\
+				    skb_shinfo(skb)->gso_size);		\
+	ip_select_ident_more(iph, &rt->u.dst, NULL, segs - 1);		\
 									\
 	err = ip_local_out(skb);					\
 	if (net_xmit_eval(err) == 0) {					\
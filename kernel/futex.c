@@ -59,6 +59,9 @@
 #include <linux/magic.h>
 #include <linux/pid.h>
 #include <linux/nsproxy.h>
+#include <linux/bootmem.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <asm/futex.h>
 
@@ -66,7 +69,12 @@
 
 int __read_mostly futex_cmpxchg_enabled;
 
-#define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
+/*
+ * Number of hash buckets given to an mm for its private futexes, when
+ * it first uses one; 0 to hash them into the global table like shared
+ * ones.
+ */
+int sysctl_futex_private_hash __read_mostly;
 
 /*
  * Priority Inheritance state:
@@ -130,19 +138,132 @@ struct futex_q {
 struct futex_hash_bucket {
 	spinlock_t lock;
 	struct plist_head chain;
-};
+#ifdef CONFIG_FUTEX_STATS
+	unsigned long acquired;
+	unsigned long contended;
+#endif
+} ____cacheline_aligned_in_smp;
 
-static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
+/*
+ * The global table is sized at boot from the number of possible CPUs
+ * and allocated by alloc_large_system_hash(), which caps it by the
+ * amount of memory and spreads it over all nodes on NUMA machines.
+ */
+static struct futex_hash_bucket *futex_queues __read_mostly;
+static unsigned int futex_hash_mask __read_mostly;
 
 /*
  * We hash on the keys returned from get_futex_key (see below).
+ * Private keys go to the mm's table, which get_futex_key() has set up.
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+	struct mm_struct *mm = key->private.mm;
+	struct futex_hash_bucket *table;
+
+	if (!(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED)) && mm) {
+		table = ACCESS_ONCE(mm->futex_hash);
+		if (table) {
+			/* pairs with the smp_wmb() in futex_mm_hash_init() */
+			smp_rmb();
+			return &table[hash & mm->futex_hash_mask];
+		}
+	}
+
+	return &futex_queues[hash & futex_hash_mask];
+}
+
+static inline void futex_hb_init(struct futex_hash_bucket *hb)
+{
+	plist_head_init(&hb->chain, &hb->lock);
+	spin_lock_init(&hb->lock);
+#ifdef CONFIG_FUTEX_STATS
+	hb->acquired = 0;
+	hb->contended = 0;
+#endif
+}
+
+/*
+ * Take a hash bucket lock, counting contended acquisitions when
+ * CONFIG_FUTEX_STATS is set.  The counters are only written with the
+ * lock held.
+ */
+static inline void __hb_lock(struct futex_hash_bucket *hb, int subclass)
+{
+#ifdef CONFIG_FUTEX_STATS
+	if (!spin_trylock(&hb->lock)) {
+		spin_lock_nested(&hb->lock, subclass);
+		hb->contended++;
+	}
+	hb->acquired++;
+#else
+	spin_lock_nested(&hb->lock, subclass);
+#endif
+}
+
+static inline void hb_lock(struct futex_hash_bucket *hb)
+{
+	__hb_lock(hb, 0);
+}
+
+/*
+ * Take the hash bucket lock a futex_q points at through q->lock_ptr,
+ * so that those acquisitions are counted as well.
+ */
+static inline void hb_lock_ptr(spinlock_t *lock_ptr)
+{
+	hb_lock(container_of(lock_ptr, struct futex_hash_bucket, lock));
+}
+
+/*
+ * Most processes never touch a private futex, so an mm's table is only
+ * allocated by the first private futex operation, in get_futex_key()
+ * before any key of the mm is hashed.  The choice is made once: if the
+ * table is disabled or cannot be allocated, the mm is pointed at the
+ * global table for good, so that waiters and wakers always agree on
+ * where a key lives.
+ */
+void futex_mm_init(struct mm_struct *mm)
+{
+	mm->futex_hash = NULL;
+	mm->futex_hash_mask = 0;
+}
+
+static void futex_mm_hash_init(struct mm_struct *mm)
+{
+	struct futex_hash_bucket *hb = NULL;
+	unsigned int i, size = sysctl_futex_private_hash;
+
+	if (size) {
+		size = roundup_pow_of_two(size);
+		hb = kmalloc(size * sizeof(*hb), GFP_KERNEL | __GFP_NOWARN);
+		if (hb) {
+			for (i = 0; i < size; i++)
+				futex_hb_init(&hb[i]);
+		}
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (!mm->futex_hash) {
+		mm->futex_hash_mask = hb ? size - 1 : futex_hash_mask;
+		smp_wmb();
+		mm->futex_hash = hb ? hb : futex_queues;
+		hb = NULL;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	/* another thread of the mm got there first */
+	kfree(hb);
+}
+
+void futex_mm_free(struct mm_struct *mm)
+{
+	if (mm->futex_hash != futex_queues)
+		kfree(mm->futex_hash);
+	mm->futex_hash = NULL;
 }
 
 /*
@@ -241,6 +362,8 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key, int rw)
 	if (!fshared) {
 		if (unlikely(!access_ok(VERIFY_WRITE, uaddr, sizeof(u32))))
 			return -EFAULT;
+		if (unlikely(!mm->futex_hash))
+			futex_mm_hash_init(mm);
 		key->private.mm = mm;
 		key->private.address = address;
 		get_futex_key_refs(key);
@@ -509,7 +632,7 @@ void exit_pi_state_list(struct task_struct *curr)
 		hb = hash_futex(&key);
 		spin_unlock_irq(&curr->pi_lock);
 
-		spin_lock(&hb->lock);
+		hb_lock(hb);
 
 		spin_lock_irq(&curr->pi_lock);
 		/*
@@ -989,12 +1112,12 @@ static inline void
 double_lock_hb(struct futex_hash_bucket *hb1, struct futex_hash_bucket *hb2)
 {
 	if (hb1 <= hb2) {
-		spin_lock(&hb1->lock);
+		hb_lock(hb1);
 		if (hb1 < hb2)
-			spin_lock_nested(&hb2->lock, SINGLE_DEPTH_NESTING);
+			__hb_lock(hb2, SINGLE_DEPTH_NESTING);
 	} else { /* hb1 > hb2 */
-		spin_lock(&hb2->lock);
-		spin_lock_nested(&hb1->lock, SINGLE_DEPTH_NESTING);
+		hb_lock(hb2);
+		__hb_lock(hb1, SINGLE_DEPTH_NESTING);
 	}
 }
 
@@ -1025,7 +1148,7 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 		goto out;
 
 	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 	head = &hb->chain;
 
 	plist_for_each_entry_safe(this, next, head, list) {
@@ -1533,7 +1656,7 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 	hb = hash_futex(&q->key);
 	q->lock_ptr = &hb->lock;
 
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 	return hb;
 }
 
@@ -1599,7 +1722,7 @@ retry:
 	lock_ptr = q->lock_ptr;
 	barrier();
 	if (lock_ptr != NULL) {
-		spin_lock(lock_ptr);
+		hb_lock_ptr(lock_ptr);
 		/*
 		 * q->lock_ptr can change between reading it and
 		 * spin_lock(), causing us to take the wrong lock.  This
@@ -1733,7 +1856,7 @@ handle_fault:
 
 	ret = fault_in_user_writeable(uaddr);
 
-	spin_lock(q->lock_ptr);
+	hb_lock_ptr(q->lock_ptr);
 
 	/*
 	 * Check if someone else fixed it for us:
@@ -2126,7 +2249,7 @@ retry_private:
 		ret = ret ? 0 : -EWOULDBLOCK;
 	}
 
-	spin_lock(q.lock_ptr);
+	hb_lock_ptr(q.lock_ptr);
 	/*
 	 * Fixup the pi_state owner and possibly acquire the lock if we
 	 * haven't already.
@@ -2203,7 +2326,7 @@ retry:
 		goto out;
 
 	hb = hash_futex(&key);
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 
 	/*
 	 * To avoid races, try to do the TID -> 0 atomic transition
@@ -2422,7 +2545,7 @@ static int futex_wait_requeue_pi(u32 __user *uaddr, int fshared,
 	/* Queue the futex_q, drop the hb lock, wait for wakeup. */
 	futex_wait_queue_me(hb, &q, to);
 
-	spin_lock(&hb->lock);
+	hb_lock(hb);
 	ret = handle_early_requeue_pi_wakeup(hb, &q, &key2, to);
 	spin_unlock(&hb->lock);
 	if (ret)
@@ -2444,7 +2567,7 @@ static int futex_wait_requeue_pi(u32 __user *uaddr, int fshared,
 		 * did a lock-steal - fix up the PI-state in that case.
 		 */
 		if (q.pi_state && (q.pi_state->owner != current)) {
-			spin_lock(q.lock_ptr);
+			hb_lock_ptr(q.lock_ptr);
 			ret = fixup_pi_state_owner(uaddr2, &q, current,
 						   fshared);
 			spin_unlock(q.lock_ptr);
@@ -2460,7 +2583,7 @@ static int futex_wait_requeue_pi(u32 __user *uaddr, int fshared,
 		ret = rt_mutex_finish_proxy_lock(pi_mutex, to, &rt_waiter, 1);
 		debug_rt_mutex_free_waiter(&rt_waiter);
 
-		spin_lock(q.lock_ptr);
+		hb_lock_ptr(q.lock_ptr);
 		/*
 		 * Fixup the pi_state owner and possibly acquire the lock if we
 		 * haven't already.
@@ -2815,10 +2938,74 @@ SYSCALL_DEFINE6(futex, u32 __user *, uaddr, int, op, u32, val,
 	return do_futex(uaddr, op, val, tp, uaddr2, val2, val3);
 }
 
+#ifdef CONFIG_FUTEX_STATS
+/*
+ * debugfs "futex_stats": one line per global hash bucket that has been
+ * used, giving the bucket index, the number of lock acquisitions and
+ * how many of those had to spin.
+ */
+static void *futex_stats_start(struct seq_file *m, loff_t *pos)
+{
+	if (*pos == 0)
+		return SEQ_START_TOKEN;
+	if (*pos > futex_hash_mask + 1)
+		return NULL;
+	return &futex_queues[*pos - 1];
+}
+
+static void *futex_stats_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return futex_stats_start(m, pos);
+}
+
+static void futex_stats_stop(struct seq_file *m, void *v)
+{
+}
+
+static int futex_stats_show(struct seq_file *m, void *v)
+{
+	struct futex_hash_bucket *hb = v;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_printf(m, "buckets: %u\n", futex_hash_mask + 1);
+		seq_printf(m, "%8s %14s %14s\n",
+			   "bucket", "acquired", "contended");
+		return 0;
+	}
+
+	if (hb->acquired)
+		seq_printf(m, "%8lu %14lu %14lu\n",
+			   (unsigned long)(hb - futex_queues),
+			   hb->acquired, hb->contended);
+	return 0;
+}
+
+static const struct seq_operations futex_stats_ops = {
+	.start	= futex_stats_start,
+	.next	= futex_stats_next,
+	.stop	= futex_stats_stop,
+	.show	= futex_stats_show,
+};
+
+static int futex_stats_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &futex_stats_ops);
+}
+
+static const struct file_operations futex_stats_fops = {
+	.open		= futex_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+#endif
+
 static int __init futex_init(void)
 {
+	unsigned int futex_shift;
+	unsigned long i, size;
 	u32 curval;
-	int i;
 
 	/*
 	 * This will fail and we want it. Some arch implementations do
@@ -2834,10 +3021,25 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+#if CONFIG_BASE_SMALL
+	size = 16;
+#else
+	size = roundup_pow_of_two(256 * num_possible_cpus());
+#endif
+
+	futex_queues = alloc_large_system_hash("futex", sizeof(*futex_queues),
+					       size, 0, 0,
+					       &futex_shift, NULL, 0);
+	size = 1UL << futex_shift;
+	futex_hash_mask = size - 1;
+
+	for (i = 0; i < size; i++)
+		futex_hb_init(&futex_queues[i]);
+
+#ifdef CONFIG_FUTEX_STATS
+	debugfs_create_file("futex_stats", 0400, NULL, NULL,
+			    &futex_stats_fops);
+#endif
 
 	return 0;
 }
@@ -0,0 +1,1437 @@
+/*
+ *  Transparent hugepages for anonymous memory.
+ *
+ *  An anonymous vma that is large enough and suitably aligned gets its
+ *  memory faulted in HPAGE_PMD_SIZE at a time, mapped by a single pmd.
+ *  khugepaged collapses ranges that were populated with small pages.
+ *
+ *  A transparent hugepage is mapped by exactly one pmd and is not on the
+ *  LRU: whenever something needs to see small pages (fork, mprotect,
+ *  mremap, get_user_pages, a partial unmap, or reclaim needing to swap
+ *  it out) the pmd is split in place into a page table of 512 ptes and
+ *  the compound page into 512 ordinary anonymous pages.
+ *
+ *  This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/mmu_notifier.h>
+#include <linux/memcontrol.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/kthread.h>
+#include <linux/khugepaged.h>
+#include <linux/freezer.h>
+#include <linux/ksm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <asm/tlb.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+/*
+ * By default transparent hugepage support is enabled for all mappings
+ * and khugepaged scans all mappings.  Defrag lets the huge page fault
+ * enter direct reclaim when no huge page is readily available.
+ */
+unsigned long transparent_hugepage_flags __read_mostly =
+	(1<<TRANSPARENT_HUGEPAGE_FLAG)|
+	(1<<TRANSPARENT_HUGEPAGE_DEFRAG_FLAG);
+
+/* default scan 8*512 pte (or vmas) every 10 second */
+static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR*8;
+static unsigned int khugepaged_pages_collapsed;
+static unsigned int khugepaged_full_scans;
+static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
+/* during fragmentation poll the hugepage allocator once every minute */
+static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
+/*
+ * default collapse hugepages if there is at least one pte mapped like
+ * it would have happened if the vma was large enough during page
+ * fault.
+ */
+static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR-1;
+
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+static DEFINE_SPINLOCK(khugepaged_mm_lock);
+
+#define MM_SLOTS_HASH_HEADS 1024
+static struct hlist_head *mm_slots_hash __read_mostly;
+static struct kmem_cache *mm_slot_cache __read_mostly;
+
+/**
+ * struct mm_slot - hash lookup from mm to mm_slot
+ * @hash: hash collision list
+ * @mm_node: khugepaged scan list headed in khugepaged_scan.mm_head
+ * @mm: the mm that this information is valid for
+ */
+struct mm_slot {
+	struct hlist_node hash;
+	struct list_head mm_node;
+	struct mm_struct *mm;
+};
+
+/**
+ * struct khugepaged_scan - cursor for scanning
+ * @mm_head: the head of the mm list to scan
+ * @mm_slot: the current mm_slot we are scanning
+ * @address: the next address inside that to be scanned
+ *
+ * There is only the one khugepaged_scan instance of this cursor structure.
+ */
+struct khugepaged_scan {
+	struct list_head mm_head;
+	struct mm_slot *mm_slot;
+	unsigned long address;
+};
+static struct khugepaged_scan khugepaged_scan = {
+	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+};
+
+/*
+ * All mapped transparent hugepages, linked through the head page's lru
+ * (they are never on the LRU), so that the shrinker can find one to split
+ * when memory gets tight.  Nests inside mm->page_table_lock.
+ */
+static LIST_HEAD(huge_anon_list);
+static DEFINE_SPINLOCK(huge_anon_lock);
+static unsigned long huge_anon_nr;
+
+static inline int khugepaged_enabled(void)
+{
+	return transparent_hugepage_flags &
+		((1<<TRANSPARENT_HUGEPAGE_FLAG) |
+		 (1<<TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG));
+}
+
+static inline int khugepaged_has_work(void)
+{
+	return !list_empty(&khugepaged_scan.mm_head) && khugepaged_enabled();
+}
+
+static inline int khugepaged_test_exit(struct mm_struct *mm)
+{
+	return atomic_read(&mm->mm_users) == 0;
+}
+
+static inline gfp_t alloc_hugepage_gfpmask(struct vm_area_struct *vma)
+{
+	int defrag;
+
+	defrag = test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+			  &transparent_hugepage_flags) ||
+		 (test_bit(TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG,
+			   &transparent_hugepage_flags) &&
+		  (vma->vm_flags & VM_HUGEPAGE));
+	return GFP_TRANSHUGE & ~(defrag ? 0 : __GFP_WAIT);
+}
+
+static void huge_anon_list_add(struct page *page)
+{
+	spin_lock(&huge_anon_lock);
+	list_add(&page->lru, &huge_anon_list);
+	huge_anon_nr++;
+	spin_unlock(&huge_anon_lock);
+}
+
+static void huge_anon_list_del(struct page *page)
+{
+	spin_lock(&huge_anon_lock);
+	list_del(&page->lru);
+	huge_anon_nr--;
+	spin_unlock(&huge_anon_lock);
+}
+
+/*
+ * Splitting a huge pmd must not fail, so the page table it will need is
+ * allocated up front and set aside until then.  Any deposited table will
+ * do: they are all empty.  Called with the page_table_lock held.
+ */
+static void pgtable_trans_huge_deposit(struct mm_struct *mm, pgtable_t pgtable)
+{
+	assert_spin_locked(&mm->page_table_lock);
+
+	if (!mm->pmd_huge_pte)
+		INIT_LIST_HEAD(&pgtable->lru);
+	else
+		list_add(&pgtable->lru, &mm->pmd_huge_pte->lru);
+	mm->pmd_huge_pte = pgtable;
+}
+
+static pgtable_t pgtable_trans_huge_withdraw(struct mm_struct *mm)
+{
+	pgtable_t pgtable;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	pgtable = mm->pmd_huge_pte;
+	VM_BUG_ON(!pgtable);
+	if (list_empty(&pgtable->lru))
+		mm->pmd_huge_pte = NULL;
+	else {
+		mm->pmd_huge_pte = list_entry(pgtable->lru.next,
+					      struct page, lru);
+		list_del(&pgtable->lru);
+	}
+	return pgtable;
+}
+
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+	return pmd_offset(pud, address);
+}
+
+static void clear_huge_page(struct page *page, unsigned long haddr)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		cond_resched();
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+	}
+}
+
+static pmd_t mk_huge_pmd(struct page *page, struct vm_area_struct *vma)
+{
+	pmd_t entry;
+
+	entry = mk_pmd(page, vma->vm_page_prot);
+	entry = pmd_mkhuge(pmd_mkyoung(pmd_mkdirty(entry)));
+	if (likely(vma->vm_flags & VM_WRITE))
+		entry = pmd_mkwrite(entry);
+	return entry;
+}
+
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd,
+			       unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	/* huge pages are not charged to a memory cgroup */
+	if (!mem_cgroup_disabled())
+		return VM_FAULT_FALLBACK;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+	/* failing to register only means khugepaged will not look here */
+	khugepaged_enter(vma);
+
+	page = alloc_pages(alloc_hugepage_gfpmask(vma), HPAGE_PMD_ORDER);
+	if (unlikely(!page))
+		return VM_FAULT_FALLBACK;
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable)) {
+		put_page(page);
+		return VM_FAULT_OOM;
+	}
+
+	clear_huge_page(page, haddr);
+	/*
+	 * The memory barrier inside __SetPageUptodate makes sure that
+	 * clear_huge_page writes become visible before the set_pmd
+	 * write.
+	 */
+	__SetPageUptodate(page);
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		put_page(page);
+		pte_free(mm, pgtable);
+		return 0;
+	}
+	hugepage_add_new_anon_rmap(page, vma, haddr);
+	set_pmd(pmd, mk_huge_pmd(page, vma));
+	pgtable_trans_huge_deposit(mm, pgtable);
+	mm->nr_ptes++;
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR);
+	huge_anon_list_add(page);
+	spin_unlock(&mm->page_table_lock);
+
+	return 0;
+}
+
+struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+				   unsigned long address, pmd_t *pmd,
+				   unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page = NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd) && pmd_present(*pmd)) &&
+	    !((flags & FOLL_WRITE) && !pmd_write(*pmd))) {
+		page = pmd_page(*pmd);
+		VM_BUG_ON(!PageHead(page));
+		/* the pmd was made young and dirty when it was installed */
+		page += (address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	return page;
+}
+
+int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		 pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	pgtable_t pgtable;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	page = pmd_page(*pmd);
+	pmd_clear(pmd);
+	pgtable = pgtable_trans_huge_withdraw(mm);
+	mm->nr_ptes--;
+	add_mm_counter(mm, anon_rss, -HPAGE_PMD_NR);
+	huge_anon_list_del(page);
+	hugepage_remove_rmap(page);
+	VM_BUG_ON(page_mapcount(page));
+	spin_unlock(&mm->page_table_lock);
+
+	pte_free(mm, pgtable);
+	tlb_remove_page(tlb, page);
+	return 1;
+}
+
+/*
+ * Turn the compound page into HPAGE_PMD_NR independent anonymous pages,
+ * each mapped once.  The tail pages had no references of their own:
+ * they get the one of the pte that is about to map them.
+ */
+static void __split_huge_page_refcount(struct page *page)
+{
+	int i;
+
+	for (i = 1; i < HPAGE_PMD_NR; i++) {
+		struct page *page_tail = page + i;
+
+		VM_BUG_ON(page_count(page_tail));
+		VM_BUG_ON(page_mapcount(page_tail));
+		atomic_set(&page_tail->_count, 1);
+		__ClearPageTail(page_tail);
+		set_page_private(page_tail, 0);
+		__SetPageUptodate(page_tail);
+		SetPageSwapBacked(page_tail);
+		atomic_set(&page_tail->_mapcount, 0);
+		page_tail->mapping = page->mapping;
+		page_tail->index = page->index + i;
+	}
+	__ClearPageHead(page);
+
+	__mod_zone_page_state(page_zone(page), NR_ANON_PAGES, HPAGE_PMD_NR);
+	__dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+}
+
+/*
+ * Split the huge pmd mapping @expected (or whatever huge page @pmd maps
+ * when @expected is NULL).  Returns 1 if a split was done.
+ */
+static int __split_huge_page_map(struct vm_area_struct *vma,
+				 unsigned long address, pmd_t *pmd,
+				 struct page *expected)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t orig_pmd, _pmd;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	orig_pmd = *pmd;
+	if (unlikely(!pmd_trans_huge(orig_pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	page = pmd_page(orig_pmd);
+	if (expected && page != expected) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	VM_BUG_ON(!PageHead(page));
+	VM_BUG_ON(page_mapcount(page) != 1);
+	VM_BUG_ON(haddr < vma->vm_start ||
+		  haddr + HPAGE_PMD_SIZE > vma->vm_end);
+
+	huge_anon_list_del(page);
+	pgtable = pgtable_trans_huge_withdraw(mm);
+	__split_huge_page_refcount(page);
+
+	/* fill in the ptes before the table becomes visible */
+	pmd_populate(mm, &_pmd, pgtable);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		unsigned long addr = haddr + i * PAGE_SIZE;
+		pte_t *pte, entry;
+
+		entry = mk_pte(page + i, vma->vm_page_prot);
+		entry = pte_mkdirty(entry);
+		if (pmd_write(orig_pmd))
+			entry = pte_mkwrite(entry);
+		if (!pmd_young(orig_pmd))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, addr);
+		BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, addr, pte, entry);
+		pte_unmap(pte);
+	}
+	smp_wmb();
+
+	/*
+	 * Some CPUs do not like a small and a huge TLB entry for the same
+	 * address being loaded at once (AMD erratum 383), so the huge
+	 * mapping is taken down and flushed before the page table goes
+	 * in.  The pmd stays pmd_trans_huge() in between, which keeps
+	 * walkers that do not hold mmap_sem for write (MADV_DONTNEED,
+	 * a concurrent fault) waiting on the page_table_lock instead of
+	 * seeing an empty pmd.
+	 */
+	set_pmd(pmd, pmd_mknotpresent(orig_pmd));
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+	pmd_populate(mm, pmd, pgtable);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		struct page *page_tail = page + i;
+
+		if (page_evictable(page_tail, vma))
+			lru_cache_add_lru(page_tail, LRU_ACTIVE_ANON);
+		else
+			add_page_to_unevictable_list(page_tail);
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	return 1;
+}
+
+void __split_huge_page_pmd(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd)
+{
+	__split_huge_page_map(vma, address, pmd, NULL);
+}
+
+void split_huge_page_pmd_mm(struct mm_struct *mm, unsigned long address,
+			    pmd_t *pmd)
+{
+	struct vm_area_struct *vma;
+
+	if (likely(!pmd_trans_huge(*pmd)))
+		return;
+	vma = find_vma(mm, address);
+	VM_BUG_ON(!vma || vma->vm_start > address);
+	__split_huge_page_pmd(vma, address, pmd);
+}
+
+static void split_huge_page_address(struct vm_area_struct *vma,
+				    unsigned long address)
+{
+	pmd_t *pmd;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+	pmd = mm_find_pmd(vma->vm_mm, address);
+	if (pmd)
+		split_huge_page_pmd(vma, address, pmd);
+}
+
+/*
+ * Split a transparent hugepage given only the page, by finding the pmd
+ * that maps it through the anon_vma.  The anon_vma lock keeps the vma and
+ * its page tables from going away, so mmap_sem is not needed.
+ */
+void split_huge_page(struct page *page)
+{
+	struct anon_vma *anon_vma;
+	struct vm_area_struct *vma;
+
+	anon_vma = page_lock_anon_vma(page);
+	if (!anon_vma)
+		return;
+	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
+		unsigned long address;
+		pmd_t *pmd;
+
+		address = vma->vm_start +
+			((page->index - vma->vm_pgoff) << PAGE_SHIFT);
+		if (address < vma->vm_start ||
+		    address + HPAGE_PMD_SIZE > vma->vm_end)
+			continue;
+		pmd = mm_find_pmd(vma->vm_mm, address);
+		if (pmd && __split_huge_page_map(vma, address, pmd, page))
+			break;
+	}
+	page_unlock_anon_vma(anon_vma);
+}
+
+void __vma_adjust_trans_huge(struct vm_area_struct *vma,
+			     unsigned long start,
+			     unsigned long end,
+			     long adjust_next)
+{
+	/*
+	 * If the new start address isn't hpage aligned and it could
+	 * previously contain an hugepage: check if we need to split
+	 * an huge pmd.
+	 */
+	if (start & ~HPAGE_PMD_MASK &&
+	    (start & HPAGE_PMD_MASK) >= vma->vm_start &&
+	    (start & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
+		split_huge_page_address(vma, start & HPAGE_PMD_MASK);
+
+	/*
+	 * If the new end address isn't hpage aligned and it could
+	 * previously contain an hugepage: check if we need to split
+	 * an huge pmd.
+	 */
+	if (end & ~HPAGE_PMD_MASK &&
+	    (end & HPAGE_PMD_MASK) >= vma->vm_start &&
+	    (end & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= vma->vm_end)
+		split_huge_page_address(vma, end & HPAGE_PMD_MASK);
+
+	/*
+	 * If we're also updating the vma->vm_next->vm_start, if the new
+	 * vm_next->vm_start isn't page aligned and it could previously
+	 * contain an hugepage: check if we need to split an huge pmd.
+	 */
+	if (adjust_next > 0) {
+		struct vm_area_struct *next = vma->vm_next;
+		unsigned long nstart = next->vm_start;
+
+		nstart += adjust_next << PAGE_SHIFT;
+		if (nstart & ~HPAGE_PMD_MASK &&
+		    (nstart & HPAGE_PMD_MASK) >= next->vm_start &&
+		    (nstart & HPAGE_PMD_MASK) + HPAGE_PMD_SIZE <= next->vm_end)
+			split_huge_page_address(next, nstart & HPAGE_PMD_MASK);
+	}
+}
+
+int hugepage_madvise(struct vm_area_struct *vma,
+		     unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		/*
+		 * Be somewhat over-protective like KSM for now!
+		 */
+		if (*vm_flags & (VM_SHARED   | VM_MAYSHARE | VM_PFNMAP    |
+				 VM_IO       | VM_DONTEXPAND | VM_RESERVED |
+				 VM_HUGETLB  | VM_INSERTPAGE | VM_MIXEDMAP |
+				 VM_SAO))
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		/*
+		 * The vma only gets the new flags after we return, so
+		 * khugepaged_enter(vma) cannot tell yet: register directly.
+		 */
+		if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags) &&
+		    __khugepaged_enter(vma->vm_mm))
+			return -ENOMEM;
+		break;
+	case MADV_NOHUGEPAGE:
+		if (*vm_flags & (VM_SHARED   | VM_MAYSHARE | VM_PFNMAP    |
+				 VM_IO       | VM_DONTEXPAND | VM_RESERVED |
+				 VM_HUGETLB  | VM_INSERTPAGE | VM_MIXEDMAP |
+				 VM_SAO))
+			return -EINVAL;
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		/*
+		 * Huge pages already mapped stay until unmapped or split
+		 * under memory pressure; khugepaged will not add more.
+		 */
+		break;
+	}
+
+	return 0;
+}
+
+/*
+ * Reclaim cannot swap out a transparent hugepage, it has to be split
+ * first.  Report them in small pages so that shrink_slab() splits at a
+ * rate proportional to the LRU scanning, and only when there is swap to
+ * put the resulting small pages in: without swap, splitting anonymous
+ * memory gains nothing but TLB misses.
+ */
+static int shrink_huge_anon(int nr_to_scan, gfp_t gfp_mask)
+{
+	if (nr_swap_pages <= 0)
+		return 0;
+
+	nr_to_scan = DIV_ROUND_UP(nr_to_scan, HPAGE_PMD_NR);
+	while (nr_to_scan-- > 0) {
+		struct page *page;
+
+		spin_lock(&huge_anon_lock);
+		if (list_empty(&huge_anon_list)) {
+			spin_unlock(&huge_anon_lock);
+			break;
+		}
+		/* oldest first; rotate in case the split does not happen */
+		page = list_entry(huge_anon_list.prev, struct page, lru);
+		list_move(&page->lru, &huge_anon_list);
+		get_page(page);
+		spin_unlock(&huge_anon_lock);
+
+		split_huge_page(page);
+		put_page(page);
+	}
+
+	return min_t(unsigned long, huge_anon_nr * HPAGE_PMD_NR, INT_MAX);
+}
+
+static struct shrinker huge_anon_shrinker = {
+	.shrink = shrink_huge_anon,
+	/* a split loses the TLB benefit for good: make it expensive */
+	.seeks = DEFAULT_SEEKS * 4,
+};
+
+/*
+ * khugepaged
+ */
+
+static inline struct mm_slot *alloc_mm_slot(void)
+{
+	if (!mm_slot_cache)	/* initialization failed */
+		return NULL;
+	return kmem_cache_zalloc(mm_slot_cache, GFP_KERNEL);
+}
+
+static inline void free_mm_slot(struct mm_slot *mm_slot)
+{
+	kmem_cache_free(mm_slot_cache, mm_slot);
+}
+
+static struct mm_slot *get_mm_slot(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	struct hlist_head *bucket;
+	struct hlist_node *node;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	hlist_for_each_entry(mm_slot, node, bucket, hash) {
+		if (mm == mm_slot->mm)
+			return mm_slot;
+	}
+	return NULL;
+}
+
+static void insert_to_mm_slots_hash(struct mm_struct *mm,
+				    struct mm_slot *mm_slot)
+{
+	struct hlist_head *bucket;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	mm_slot->mm = mm;
+	hlist_add_head(&mm_slot->hash, bucket);
+}
+
+int __khugepaged_enter(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int wakeup;
+
+	mm_slot = alloc_mm_slot();
+	if (!mm_slot)
+		return -ENOMEM;
+
+	/* __khugepaged_exit() must not run from under us */
+	VM_BUG_ON(khugepaged_test_exit(mm));
+	if (unlikely(test_and_set_bit(MMF_VM_HUGEPAGE, &mm->flags))) {
+		free_mm_slot(mm_slot);
+		return 0;
+	}
+
+	spin_lock(&khugepaged_mm_lock);
+	insert_to_mm_slots_hash(mm, mm_slot);
+	/*
+	 * Insert just behind the scanning cursor, to let the area settle
+	 * down a little.
+	 */
+	wakeup = list_empty(&khugepaged_scan.mm_head);
+	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	spin_unlock(&khugepaged_mm_lock);
+
+	atomic_inc(&mm->mm_count);
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+
+	return 0;
+}
+
+void __khugepaged_exit(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int free = 0;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free = 1;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (free) {
+		clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	} else if (mm_slot) {
+		/*
+		 * This is required to serialize against
+		 * khugepaged_test_exit() (which is guaranteed to run
+		 * under mmap sem read mode). Stop here (after we
+		 * return all pagetables will be destroyed) until
+		 * khugepaged has finished working on the pagetables
+		 * under the mmap_sem.
+		 */
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+/* Called with khugepaged_mm_lock held */
+static void collect_mm_slot(struct mm_slot *mm_slot)
+{
+	struct mm_struct *mm = mm_slot->mm;
+
+	if (khugepaged_test_exit(mm)) {
+		/* free mm_slot */
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+
+		/*
+		 * Not strictly needed because the mm exited already.
+		 *
+		 * clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		 */
+
+		/* khugepaged_mm_lock actually not necessary for the below */
+		free_mm_slot(mm_slot);
+		mmdrop(mm);
+	}
+}
+
+static int khugepaged_vma_suitable(struct vm_area_struct *vma)
+{
+	if (!vma->anon_vma || !mem_cgroup_disabled())
+		return 0;
+	/* VM_HUGEPAGE alone is enough for "madvise" mode */
+	return transparent_hugepage_enabled(vma);
+}
+
+static void khugepaged_alloc_sleep(void)
+{
+	wait_event_freezable_timeout(khugepaged_wait, false,
+			msecs_to_jiffies(khugepaged_alloc_sleep_millisecs));
+}
+
+/*
+ * Is every pte in the range either empty or mapping an exclusively owned
+ * anonymous page of this vma?  Called with the pte lock held.
+ */
+static int __collapse_huge_page_check(struct vm_area_struct *vma,
+				      unsigned long address, pte_t *pte)
+{
+	int i, none = 0;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, pte++, address += PAGE_SIZE) {
+		pte_t pteval = *pte;
+		struct page *page;
+
+		if (pte_none(pteval)) {
+			if (++none > khugepaged_max_ptes_none)
+				return 0;
+			continue;
+		}
+		if (!pte_present(pteval))
+			return 0;
+		if (is_zero_pfn(pte_pfn(pteval))) {
+			if (++none > khugepaged_max_ptes_none)
+				return 0;
+			continue;
+		}
+		page = vm_normal_page(vma, address, pteval);
+		if (unlikely(!page))
+			return 0;
+		if (!PageAnon(page) || PageKsm(page) || PageCompound(page) ||
+		    PageSwapCache(page) || PageLocked(page))
+			return 0;
+		if ((struct anon_vma *)((unsigned long)page->mapping -
+					PAGE_MAPPING_ANON) != vma->anon_vma)
+			return 0;
+		/* no other mapping, no pagevec, no get_user_pages pin */
+		if (page_mapcount(page) != 1 || page_count(page) != 1)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Copy the small pages into the huge page and drop them; returns the
+ * number of ptes that were empty (and not accounted in the rss).
+ */
+static int __collapse_huge_page_copy(pte_t *pte, struct page *page,
+				     struct vm_area_struct *vma,
+				     unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int i, none = 0;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, pte++, address += PAGE_SIZE,
+		     page++) {
+		pte_t pteval = *pte;
+		struct page *src_page;
+
+		if (pte_none(pteval) || is_zero_pfn(pte_pfn(pteval))) {
+			clear_user_highpage(page, address);
+			pte_clear(mm, address, pte);
+			none++;
+			continue;
+		}
+		src_page = pte_page(pteval);
+		copy_user_highpage(page, src_page, address, vma);
+		pte_clear(mm, address, pte);
+		page_remove_rmap(src_page);
+		put_page(src_page);
+	}
+	return none;
+}
+
+/*
+ * Replace the page table at @address with one huge page.  Called with
+ * mmap_sem held for read, which is dropped (the collapse itself needs it
+ * for write, to keep page faults and get_user_pages out).
+ */
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address,
+			       int node)
+{
+	struct vm_area_struct *vma;
+	struct page *new_page;
+	spinlock_t *ptl;
+	pgtable_t pgtable;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	int none;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+	up_read(&mm->mmap_sem);
+
+	/* khugepaged is allowed to wait for the allocation */
+	new_page = alloc_pages_node(node, GFP_TRANSHUGE, HPAGE_PMD_ORDER);
+	if (unlikely(!new_page)) {
+		khugepaged_alloc_sleep();
+		return;
+	}
+
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end)
+		goto out;
+	if (!khugepaged_vma_suitable(vma))
+		goto out;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || !pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		goto out;
+
+	mmu_notifier_invalidate_range_start(mm, address,
+					    address + HPAGE_PMD_SIZE);
+	spin_lock(&vma->anon_vma->lock);
+
+	/*
+	 * Take the page table out so that get_user_pages_fast() cannot
+	 * find the small pages any more: the TLB flush waits for any
+	 * walk it has in progress.
+	 */
+	spin_lock(&mm->page_table_lock);
+	_pmd = *pmd;
+	pmd_clear(pmd);
+	spin_unlock(&mm->page_table_lock);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+
+	pgtable = pmd_pgtable(_pmd);
+	ptl = pte_lockptr(mm, &_pmd);
+	pte = pte_offset_map(&_pmd, address);
+	spin_lock(ptl);
+	if (unlikely(!__collapse_huge_page_check(vma, address, pte))) {
+		spin_unlock(ptl);
+		pte_unmap(pte);
+		spin_lock(&mm->page_table_lock);
+		BUG_ON(!pmd_none(*pmd));
+		set_pmd(pmd, _pmd);
+		spin_unlock(&mm->page_table_lock);
+		spin_unlock(&vma->anon_vma->lock);
+		mmu_notifier_invalidate_range_end(mm, address,
+						  address + HPAGE_PMD_SIZE);
+		goto out;
+	}
+	spin_unlock(ptl);
+	spin_unlock(&vma->anon_vma->lock);
+
+	/*
+	 * Nothing can reach the detached page table any more (rmap walks
+	 * find the pmd empty, faults and get_user_pages wait for
+	 * mmap_sem), and the pages checked above are mapped nowhere else:
+	 * copy them without holding any spinlock.
+	 */
+	none = __collapse_huge_page_copy(pte, new_page, vma, address);
+	pte_unmap(pte);
+
+	__SetPageUptodate(new_page);
+	hugepage_add_new_anon_rmap(new_page, vma, address);
+
+	/* the emptied page table is kept for a later split */
+	spin_lock(&mm->page_table_lock);
+	BUG_ON(!pmd_none(*pmd));
+	set_pmd(pmd, mk_huge_pmd(new_page, vma));
+	pgtable_trans_huge_deposit(mm, pgtable);
+	add_mm_counter(mm, anon_rss, none);
+	huge_anon_list_add(new_page);
+	spin_unlock(&mm->page_table_lock);
+
+	mmu_notifier_invalidate_range_end(mm, address,
+					  address + HPAGE_PMD_SIZE);
+
+	khugepaged_pages_collapsed++;
+	up_write(&mm->mmap_sem);
+	return;
+
+out:
+	up_write(&mm->mmap_sem);
+	put_page(new_page);
+}
+
+/*
+ * Returns 1 if a collapse was attempted, in which case mmap_sem has been
+ * released.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm,
+			       struct vm_area_struct *vma,
+			       unsigned long address)
+{
+	pmd_t *pmd;
+	pte_t *pte, *_pte;
+	spinlock_t *ptl;
+	int ret = 0, none = 0, referenced = 0, node = -1;
+	unsigned long _address;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || !pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	for (_address = address, _pte = pte; _pte < pte+HPAGE_PMD_NR;
+	     _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+		struct page *page;
+
+		if (pte_none(pteval) ||
+		    (pte_present(pteval) && is_zero_pfn(pte_pfn(pteval)))) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out_unmap;
+		}
+		if (!pte_present(pteval))
+			goto out_unmap;
+		page = vm_normal_page(vma, _address, pteval);
+		if (unlikely(!page))
+			goto out_unmap;
+		if (!PageAnon(page) || PageCompound(page) ||
+		    page_mapcount(page) != 1)
+			goto out_unmap;
+		if (node == -1)
+			node = page_to_nid(page);
+		if (pte_young(pteval) || PageReferenced(page))
+			referenced = 1;
+	}
+	/* only collapse ranges that are actually in use */
+	ret = referenced;
+out_unmap:
+	pte_unmap_unlock(pte, ptl);
+	if (ret) {
+		if (node == -1)
+			node = numa_node_id();
+		/* collapse_huge_page will return with the mmap_sem released */
+		collapse_huge_page(mm, address, node);
+	}
+	return ret;
+}
+
+static unsigned int khugepaged_scan_mm_slot(unsigned int pages)
+{
+	struct mm_slot *mm_slot;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	unsigned int progress = 0;
+
+	VM_BUG_ON(!pages);
+
+	spin_lock(&khugepaged_mm_lock);
+	if (khugepaged_scan.mm_slot)
+		mm_slot = khugepaged_scan.mm_slot;
+	else {
+		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+				     struct mm_slot, mm_node);
+		khugepaged_scan.address = 0;
+		khugepaged_scan.mm_slot = mm_slot;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	mm = mm_slot->mm;
+	down_read(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		vma = NULL;
+	else
+		vma = find_vma(mm, khugepaged_scan.address);
+
+	progress++;
+	for (; vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		cond_resched();
+		if (unlikely(khugepaged_test_exit(mm))) {
+			progress++;
+			break;
+		}
+
+		if (!khugepaged_vma_suitable(vma)) {
+			progress++;
+			continue;
+		}
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		if (hstart >= hend) {
+			progress++;
+			continue;
+		}
+		if (khugepaged_scan.address < hstart)
+			khugepaged_scan.address = hstart;
+
+		while (khugepaged_scan.address < hend) {
+			int ret;
+
+			cond_resched();
+			if (unlikely(khugepaged_test_exit(mm)))
+				goto breakouterloop;
+
+			ret = khugepaged_scan_pmd(mm, vma,
+						  khugepaged_scan.address);
+			/* move to next address */
+			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			progress += HPAGE_PMD_NR;
+			if (ret)
+				/* we released mmap_sem so break loop */
+				goto breakouterloop_mmap_sem;
+			if (progress >= pages)
+				goto breakouterloop;
+		}
+	}
+breakouterloop:
+	up_read(&mm->mmap_sem); /* exit_mmap will destroy ptes after this */
+breakouterloop_mmap_sem:
+
+	spin_lock(&khugepaged_mm_lock);
+	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	/*
+	 * Release the current mm_slot if this mm is about to die, or
+	 * if we scanned all vmas of this mm.
+	 */
+	if (khugepaged_test_exit(mm) || !vma) {
+		/*
+		 * Make sure that if mm_users is reaching zero while
+		 * khugepaged runs here, khugepaged_exit will find
+		 * mm_slot not pointing to the exiting mm.
+		 */
+		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
+			khugepaged_scan.mm_slot = list_entry(
+				mm_slot->mm_node.next,
+				struct mm_slot, mm_node);
+			khugepaged_scan.address = 0;
+		} else {
+			khugepaged_scan.mm_slot = NULL;
+			khugepaged_full_scans++;
+		}
+
+		collect_mm_slot(mm_slot);
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	return progress;
+}
+
+static void khugepaged_do_scan(void)
+{
+	unsigned int progress = 0, pass_through_head = 0;
+	unsigned int pages = khugepaged_pages_to_scan;
+
+	while (progress < pages) {
+		cond_resched();
+
+		if (unlikely(kthread_should_stop() || freezing(current)))
+			break;
+
+		spin_lock(&khugepaged_mm_lock);
+		if (!khugepaged_scan.mm_slot)
+			pass_through_head++;
+		if (!khugepaged_has_work() || pass_through_head >= 2) {
+			spin_unlock(&khugepaged_mm_lock);
+			break;
+		}
+		spin_unlock(&khugepaged_mm_lock);
+
+		progress += khugepaged_scan_mm_slot(pages - progress);
+	}
+}
+
+static int khugepaged_wait_event(void)
+{
+	return khugepaged_has_work() || kthread_should_stop();
+}
+
+static int khugepaged(void *none)
+{
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		khugepaged_do_scan();
+
+		if (khugepaged_has_work())
+			wait_event_freezable_timeout(khugepaged_wait,
+				kthread_should_stop(),
+				msecs_to_jiffies(khugepaged_scan_sleep_millisecs));
+		else
+			wait_event_freezable(khugepaged_wait,
+					     khugepaged_wait_event());
+	}
+	return 0;
+}
+
+static int __init setup_transparent_hugepage(char *str)
+{
+	int ret = 0;
+
+	if (!str)
+		goto out;
+	if (!strcmp(str, "always")) {
+		set_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			&transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+		ret = 1;
+	} else if (!strcmp(str, "madvise")) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		set_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags);
+		ret = 1;
+	} else if (!strcmp(str, "never")) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+		ret = 1;
+	}
+out:
+	if (!ret)
+		printk(KERN_WARNING
+		       "transparent_hugepage= cannot parse, ignored\n");
+	return ret;
+}
+__setup("transparent_hugepage=", setup_transparent_hugepage);
+
+#ifdef CONFIG_SYSFS
+/*
+ * This all compiles without CONFIG_SYSFS, but is a waste of space.
+ */
+
+#define HUGEPAGE_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define HUGEPAGE_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t double_flag_show(char *buf,
+				enum transparent_hugepage_flag enabled,
+				enum transparent_hugepage_flag req_madv)
+{
+	if (test_bit(enabled, &transparent_hugepage_flags)) {
+		VM_BUG_ON(test_bit(req_madv, &transparent_hugepage_flags));
+		return sprintf(buf, "[always] madvise never\n");
+	} else if (test_bit(req_madv, &transparent_hugepage_flags))
+		return sprintf(buf, "always [madvise] never\n");
+	else
+		return sprintf(buf, "always madvise [never]\n");
+}
+
+static ssize_t double_flag_store(const char *buf, size_t count,
+				 enum transparent_hugepage_flag enabled,
+				 enum transparent_hugepage_flag req_madv)
+{
+	if (sysfs_streq(buf, "always")) {
+		set_bit(enabled, &transparent_hugepage_flags);
+		clear_bit(req_madv, &transparent_hugepage_flags);
+	} else if (sysfs_streq(buf, "madvise")) {
+		clear_bit(enabled, &transparent_hugepage_flags);
+		set_bit(req_madv, &transparent_hugepage_flags);
+	} else if (sysfs_streq(buf, "never")) {
+		clear_bit(enabled, &transparent_hugepage_flags);
+		clear_bit(req_madv, &transparent_hugepage_flags);
+	} else
+		return -EINVAL;
+
+	return count;
+}
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return double_flag_show(buf, TRANSPARENT_HUGEPAGE_FLAG,
+				TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = double_flag_store(buf, count, TRANSPARENT_HUGEPAGE_FLAG,
+				TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG);
+	if (ret > 0)
+		wake_up_interruptible(&khugepaged_wait);
+	return ret;
+}
+HUGEPAGE_ATTR(enabled);
+
+static ssize_t defrag_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf)
+{
+	return double_flag_show(buf, TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+				TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG);
+}
+
+static ssize_t defrag_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	return double_flag_store(buf, count, TRANSPARENT_HUGEPAGE_DEFRAG_FLAG,
+				 TRANSPARENT_HUGEPAGE_DEFRAG_REQ_MADV_FLAG);
+}
+HUGEPAGE_ATTR(defrag);
+
+static struct attribute *hugepage_attrs[] = {
+	&enabled_attr.attr,
+	&defrag_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attrs,
+};
+
+static ssize_t uint_show(char *buf, unsigned int val)
+{
+	return sprintf(buf, "%u\n", val);
+}
+
+static ssize_t uint_store(const char *buf, size_t count, unsigned int *val,
+			  unsigned long max)
+{
+	unsigned long v;
+	int err;
+
+	err = strict_strtoul(buf, 10, &v);
+	if (err || v > max)
+		return -EINVAL;
+
+	*val = v;
+	return count;
+}
+
+static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return uint_show(buf, khugepaged_scan_sleep_millisecs);
+}
+
+static ssize_t scan_sleep_millisecs_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = uint_store(buf, count, &khugepaged_scan_sleep_millisecs,
+			 UINT_MAX);
+	if (ret > 0)
+		wake_up_interruptible(&khugepaged_wait);
+	return ret;
+}
+HUGEPAGE_ATTR(scan_sleep_millisecs);
+
+static ssize_t alloc_sleep_millisecs_show(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  char *buf)
+{
+	return uint_show(buf, khugepaged_alloc_sleep_millisecs);
+}
+
+static ssize_t alloc_sleep_millisecs_store(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   const char *buf, size_t count)
+{
+	return uint_store(buf, count, &khugepaged_alloc_sleep_millisecs,
+			  UINT_MAX);
+}
+HUGEPAGE_ATTR(alloc_sleep_millisecs);
+
+static ssize_t pages_to_scan_show(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  char *buf)
+{
+	return uint_show(buf, khugepaged_pages_to_scan);
+}
+
+static ssize_t pages_to_scan_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	if (sysfs_streq(buf, "0"))
+		return -EINVAL;
+	return uint_store(buf, count, &khugepaged_pages_to_scan, UINT_MAX);
+}
+HUGEPAGE_ATTR(pages_to_scan);
+
+static ssize_t max_ptes_none_show(struct kobject *kobj,
+				  struct kobj_attribute *attr,
+				  char *buf)
+{
+	return uint_show(buf, khugepaged_max_ptes_none);
+}
+
+static ssize_t max_ptes_none_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	return uint_store(buf, count, &khugepaged_max_ptes_none,
+			  HPAGE_PMD_NR - 1);
+}
+HUGEPAGE_ATTR(max_ptes_none);
+
+static ssize_t pages_collapsed_show(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    char *buf)
+{
+	return uint_show(buf, khugepaged_pages_collapsed);
+}
+HUGEPAGE_ATTR_RO(pages_collapsed);
+
+static ssize_t full_scans_show(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       char *buf)
+{
+	return uint_show(buf, khugepaged_full_scans);
+}
+HUGEPAGE_ATTR_RO(full_scans);
+
+static struct attribute *khugepaged_attrs[] = {
+	&pages_to_scan_attr.attr,
+	&pages_collapsed_attr.attr,
+	&full_scans_attr.attr,
+	&scan_sleep_millisecs_attr.attr,
+	&alloc_sleep_millisecs_attr.attr,
+	&max_ptes_none_attr.attr,
+	NULL,
+};
+
+static struct attribute_group khugepaged_attr_group = {
+	.attrs = khugepaged_attrs,
+	.name = "khugepaged",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init hugepage_init(void)
+{
+	struct task_struct *khugepaged_thread;
+	int err;
+#ifdef CONFIG_SYSFS
+	struct kobject *hugepage_kobj;
+#endif
+
+	err = -ENOMEM;
+	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
+					  sizeof(struct mm_slot),
+					  __alignof__(struct mm_slot), 0, NULL);
+	if (!mm_slot_cache)
+		goto out;
+	mm_slots_hash = kzalloc(MM_SLOTS_HASH_HEADS * sizeof(struct hlist_head),
+				GFP_KERNEL);
+	if (!mm_slots_hash)
+		goto out_free_cache;
+
+	/*
+	 * With less than 512MB of RAM huge pages would mostly fragment
+	 * memory and waste it on partly used ranges: leave them opt-in.
+	 */
+	if (totalram_pages < (512 << (20 - PAGE_SHIFT)))
+		transparent_hugepage_flags = 0;
+
+	khugepaged_thread = kthread_run(khugepaged, NULL, "khugepaged");
+	if (IS_ERR(khugepaged_thread)) {
+		printk(KERN_ERR "hugepage: creating kthread failed\n");
+		err = PTR_ERR(khugepaged_thread);
+		goto out_free_hash;
+	}
+	register_shrinker(&huge_anon_shrinker);
+
+#ifdef CONFIG_SYSFS
+	hugepage_kobj = kobject_create_and_add("transparent_hugepage", mm_kobj);
+	if (unlikely(!hugepage_kobj)) {
+		printk(KERN_ERR "hugepage: failed kobject create\n");
+		return 0;
+	}
+	if (sysfs_create_group(hugepage_kobj, &hugepage_attr_group) ||
+	    sysfs_create_group(hugepage_kobj, &khugepaged_attr_group))
+		printk(KERN_ERR "hugepage: failed to register sysfs group\n");
+#endif
+
+	return 0;
+
+out_free_hash:
+	kfree(mm_slots_hash);
+	mm_slots_hash = NULL;
+out_free_cache:
+	kmem_cache_destroy(mm_slot_cache);
+	mm_slot_cache = NULL;
+out:
+	return err;
+}
+module_init(hugepage_init)
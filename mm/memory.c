@@ -457,13 +457,6 @@ static inline int is_cow_mapping(unsigned int flags)
 	return (flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE;
 }
 
-#ifndef is_zero_pfn
-static inline int is_zero_pfn(unsigned long pfn)
-{
-	return pfn == zero_pfn;
-}
-#endif
-
 #ifndef my_zero_pfn
 static inline unsigned long my_zero_pfn(unsigned long addr)
 {
@@ -702,6 +695,8 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* transparent hugepages are not shared with the child */
+		split_huge_page_pmd(vma, addr, src_pmd);
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -898,7 +893,20 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		if (pmd_trans_huge(*pmd)) {
+			if (next - addr != HPAGE_PMD_SIZE)
+				split_huge_page_pmd(vma, addr, pmd);
+			else if (zap_huge_pmd(tlb, vma, pmd)) {
+				(*zap_work) -= PAGE_SIZE;
+				continue;
+			}
+			/* fall through */
+		}
+		/*
+		 * With mmap_sem held for read (MADV_DONTNEED) a huge page
+		 * fault may populate the pmd behind our back.
+		 */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd)) {
 			(*zap_work)--;
 			continue;
 		}
@@ -1163,6 +1171,18 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	pmd = pmd_offset(pud, address);
 	if (pmd_none(*pmd))
 		goto no_page_table;
+	if (pmd_trans_huge(*pmd)) {
+		/*
+		 * A reference on a subpage would not survive a later
+		 * split, so FOLL_GET callers get the pmd split first.
+		 */
+		if (!(flags & FOLL_GET)) {
+			page = follow_trans_huge_pmd(vma, address, pmd, flags);
+			if (page)
+				goto out;
+		}
+		split_huge_page_pmd(vma, address, pmd);
+	}
 	if (pmd_huge(*pmd)) {
 		BUG_ON(flags & FOLL_GET);
 		page = follow_huge_pmd(mm, address, pmd, flags & FOLL_WRITE);
@@ -3116,13 +3136,413 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+		int ret = do_huge_pmd_anonymous_page(mm, vma, address,
+						     pmd, flags);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else
+		split_huge_page_pmd(vma, address, pmd);
+
+	/*
+	 * Use __pte_alloc instead of pte_alloc_map: pte_offset_map must
+	 * not be run on a pmd that a racing huge page fault has just
+	 * populated.
+	 */
+	if (unlikely(pmd_none(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	if (unlikely(pmd_trans_huge(*pmd)))
+		return 0;
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative page faults
+ *
+ * A not-present fault on an anonymous vma, or a read fault on a file vma
+ * whose page is already in the page cache, only needs mmap_sem to keep
+ * the vma from changing while its pte is filled in.  Taking it for that
+ * makes every fault of a multithreaded process wait for any mmap() or
+ * munmap() in another thread.  handle_speculative_fault() does these
+ * faults without mmap_sem instead:
+ *
+ * - the vma is looked up under mm->mm_rb_lock, which is taken for
+ *   writing around every insertion into and removal from mm->mm_rb, and
+ *   which is held until the fault is done, so the vma cannot be freed;
+ * - the vma's vm_sequence is sampled at lookup and checked again once
+ *   the pte lock is held, so a fault that raced with mprotect, mremap,
+ *   the merging or splitting of vmas and the like is abandoned;
+ *   mremap, which moves ptes between vmas, keeps them out altogether;
+ * - interrupts are kept disabled while the page tables are walked, as
+ *   in get_user_pages_fast(), so that the TLB shootdown which precedes
+ *   freeing a page table cannot complete under us.  For the same reason
+ *   the pte lock is only tried: its holder may be waiting on that IPI.
+ *
+ * Anything else - a missing page table, a swapped out page, a COW, a
+ * page to be read from disk, an mlocked or otherwise special vma -
+ * returns VM_FAULT_RETRY, and the fault is done again under mmap_sem.
+ */
+
+/* find_vma() without the mmap_cache, which is only valid under mmap_sem */
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long address)
+{
+	struct rb_node *rb_node = mm->mm_rb.rb_node;
+
+	while (rb_node) {
+		struct vm_area_struct *vma;
+
+		vma = rb_entry(rb_node, struct vm_area_struct, vm_rb);
+		if (address >= vma->vm_end)
+			rb_node = rb_node->rb_right;
+		else if (address < vma->vm_start)
+			rb_node = rb_node->rb_left;
+		else
+			return vma;
+	}
+	return NULL;
+}
+
+/* Can this fault be handled speculatively at all? */
+static bool spf_vma_ok(struct vm_area_struct *vma, unsigned long address,
+		       unsigned int flags)
+{
+	if (vma->vm_flags & (VM_LOCKED | VM_HUGETLB | VM_PFNMAP |
+			     VM_MIXEDMAP | VM_NONLINEAR))
+		return false;
+
+	/* the access_error() checks of the fault handler */
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE))
+			return false;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		return false;
+
+	/* Faults next to the stack guard gap may have to grow the stack */
+	address &= PAGE_MASK;
+	if ((vma->vm_flags & VM_GROWSDOWN) && address == vma->vm_start)
+		return false;
+	if ((vma->vm_flags & VM_GROWSUP) && address + PAGE_SIZE == vma->vm_end)
+		return false;
+
+	if (!vma->vm_ops) {
+		/* anonymous: a new page needs an anon_vma and no vma policy */
+		if (!(flags & FAULT_FLAG_WRITE))
+			return true;
+		return vma->anon_vma && !vma_policy(vma);
+	}
+
+	/* file: read faults on pages already in the page cache */
+	return !(flags & FAULT_FLAG_WRITE) && vma->vm_file &&
+		vma->vm_ops->fault == filemap_fault;
+}
+
+/*
+ * Disable interrupts, take mm->mm_rb_lock for reading and look up the
+ * vma and pmd for address.  On success the vma is returned with the lock
+ * still held, its sequence count in *seq and the pmd in *pmdp and
+ * *orig_pmd.  On failure the lock is dropped and NULL is returned.
+ */
+static struct vm_area_struct *spf_lock_vma(struct mm_struct *mm,
+		unsigned long address, unsigned int flags, unsigned *seq,
+		pmd_t **pmdp, pmd_t *orig_pmd)
+{
+	struct vm_area_struct *vma;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pmd_t pmdval;
+
+	local_irq_disable();
+	read_lock(&mm->mm_rb_lock);
+
+	if (test_bit(MMF_NO_SPECULATIVE_FAULT, &mm->flags))
+		goto fail;
+
+	vma = spf_find_vma(mm, address);
+	if (!vma)
+		goto fail;
+
+	/* Not read_seqcount_begin(): the writer may be waiting for us */
+	*seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if (*seq & 1)
+		goto fail;
+
+	if (!spf_vma_ok(vma, address, flags))
+		goto fail;
+
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto fail;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto fail;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)))
+		goto fail;
+
+	*pmdp = pmd;
+	*orig_pmd = pmdval;
+	return vma;
+
+fail:
+	read_unlock(&mm->mm_rb_lock);
+	local_irq_enable();
+	return NULL;
+}
+
+static void spf_unlock_vma(struct mm_struct *mm)
+{
+	read_unlock(&mm->mm_rb_lock);
+	local_irq_enable();
+}
+
+/*
+ * Lock the pte and make sure that neither the pmd nor the vma changed
+ * since spf_lock_vma().  Returns the mapped pte, or NULL.
+ */
+static pte_t *spf_lock_pte(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, unsigned seq, pmd_t *pmd,
+		pmd_t orig_pmd, spinlock_t **ptlp)
+{
+	spinlock_t *ptl = pte_lockptr(mm, pmd);
+	pte_t *pte = pte_offset_map(pmd, address);
+
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		return NULL;
+	}
+	if (pmd_val(*pmd) != pmd_val(orig_pmd) ||
+	    read_seqcount_retry(&vma->vm_sequence, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		return NULL;
+	}
+	*ptlp = ptl;
+	return pte;
+}
+
+static bool spf_pte_none(pmd_t *pmd, unsigned long address)
+{
+	pte_t *pte = pte_offset_map(pmd, address);
+	bool none = pte_none(*pte);
+
+	pte_unmap(pte);
+	return none;
+}
+
+/*
+ * do_anonymous_page(): map the zero page, or *pagep if it is not NULL.
+ * *pagep is cleared if the page was mapped.
+ */
+static int spf_anonymous_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		unsigned seq, pmd_t *pmd, pmd_t orig_pmd, struct page **pagep)
+{
+	struct page *page = *pagep;
+	spinlock_t *ptl;
+	pte_t *pte;
+	pte_t entry;
+
+	if (page) {
+		entry = mk_pte(page, vma->vm_page_prot);
+		if (vma->vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	} else
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+					      vma->vm_page_prot));
+
+	pte = spf_lock_pte(mm, vma, address, seq, pmd, orig_pmd, &ptl);
+	if (!pte)
+		return VM_FAULT_RETRY;
+	/* Someone else faulted it in meanwhile: we are done too */
+	if (!pte_none(*pte))
+		goto unlock;
+
+	if (page) {
+		inc_mm_counter(mm, anon_rss);
+		page_add_new_anon_rmap(page, vma, address);
+		*pagep = NULL;
+	}
+	set_pte_at(mm, address, pte, entry);
+	update_mmu_cache(vma, address, entry);
+unlock:
+	pte_unmap_unlock(pte, ptl);
+	return 0;
+}
+
+/*
+ * The page cache hit case of filemap_fault() and __do_fault(), for a read
+ * fault.  The page lock keeps truncation away while the pte is set up.
+ */
+static int spf_file_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, unsigned seq, pmd_t *pmd,
+		pmd_t orig_pmd)
+{
+	struct file *file = vma->vm_file;
+	struct address_space *mapping = file->f_mapping;
+	pgoff_t pgoff, size;
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t *pte;
+	pte_t entry;
+	int ret = VM_FAULT_RETRY;
+
+	pgoff = ((address - vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
+	page = find_get_page(mapping, pgoff);
+	if (!page)
+		return VM_FAULT_RETRY;
+	/* Leave the readahead it should trigger to filemap_fault() */
+	if (PageReadahead(page) || !trylock_page(page))
+		goto out_put;
+	if (unlikely(page->mapping != mapping || !PageUptodate(page) ||
+		     PageHWPoison(page)))
+		goto out_unlock;
+	size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	if (unlikely(pgoff >= size))
+		goto out_unlock;
+
+	entry = mk_pte(page, vma->vm_page_prot);
+	pte = spf_lock_pte(mm, vma, address, seq, pmd, orig_pmd, &ptl);
+	if (!pte)
+		goto out_unlock;
+	ret = 0;
+	if (!pte_none(*pte)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_unlock;
+	}
+
+	inc_mm_counter(mm, file_rss);
+	page_add_file_rmap(page);
+	set_pte_at(mm, address, pte, entry);
+	update_mmu_cache(vma, address, entry);
+	pte_unmap_unlock(pte, ptl);
+	unlock_page(page);
+
+	if (!VM_RandomReadHint(vma) && file->f_ra.mmap_miss > 0)
+		file->f_ra.mmap_miss--;
+	/* the pte keeps the reference from find_get_page() */
+	return 0;
+
+out_unlock:
+	unlock_page(page);
+out_put:
+	page_cache_release(page);
+	return ret;
+}
+
+/*
+ * Keep speculative faults out of the whole mm while page tables are
+ * moved from one vma to another, and wait for those in progress.
+ * Called with mmap_sem held for writing.
+ */
+void mm_speculative_fault_disable(struct mm_struct *mm)
+{
+	set_bit(MMF_NO_SPECULATIVE_FAULT, &mm->flags);
+	/* the unlock orders the bit before any later reader */
+	mm_rb_write_lock(mm);
+	mm_rb_write_unlock(mm);
+}
+
+void mm_speculative_fault_enable(struct mm_struct *mm)
+{
+	clear_bit(MMF_NO_SPECULATIVE_FAULT, &mm->flags);
+}
+
+/**
+ * handle_speculative_fault - handle a user page fault without mmap_sem
+ * @mm: faulting mm, which must be current->mm
+ * @address: faulting address
+ * @flags: FAULT_FLAG_WRITE for a write fault
+ *
+ * Only for faults on not-present ptes.  Returns 0 if the fault was
+ * handled, or VM_FAULT_RETRY if it must be handled by handle_mm_fault()
+ * under mmap_sem.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+	pmd_t *pmd, orig_pmd;
+	unsigned seq;
+	int ret;
+
+	__set_current_state(TASK_RUNNING);
+
+	vma = spf_lock_vma(mm, address, flags, &seq, &pmd, &orig_pmd);
+	if (!vma)
+		goto retry;
+
+	if (vma->vm_ops) {
+		ret = spf_file_page(mm, vma, address, seq, pmd, orig_pmd);
+		spf_unlock_vma(mm);
+		goto out;
+	}
+	if (!(flags & FAULT_FLAG_WRITE)) {
+		ret = spf_anonymous_page(mm, vma, address, seq, pmd, orig_pmd,
+					 &page);
+		spf_unlock_vma(mm);
+		goto out;
+	}
+
+	/* A present pte means COW, which is left to do_wp_page() */
+	if (!spf_pte_none(pmd, address)) {
+		spf_unlock_vma(mm);
+		goto retry;
+	}
+	spf_unlock_vma(mm);
+
+	/*
+	 * spf_vma_ok() made sure the vma has no policy of its own, so this
+	 * is the page alloc_zeroed_user_highpage_movable() would give us.
+	 * The vma is looked up again afterwards, it may be gone by then.
+	 */
+	page = alloc_page(GFP_HIGHUSER_MOVABLE | __GFP_ZERO);
+	if (!page)
+		goto retry;
+	__SetPageUptodate(page);
+	if (mem_cgroup_newpage_charge(page, mm, GFP_KERNEL)) {
+		page_cache_release(page);
+		goto retry;
+	}
+
+	vma = spf_lock_vma(mm, address, flags, &seq, &pmd, &orig_pmd);
+	if (!vma) {
+		ret = VM_FAULT_RETRY;
+	} else {
+		if (!vma->vm_ops)
+			ret = spf_anonymous_page(mm, vma, address, seq,
+						 pmd, orig_pmd, &page);
+		else
+			ret = VM_FAULT_RETRY;
+		spf_unlock_vma(mm);
+	}
+	if (page) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+
+out:
+	if (ret & VM_FAULT_RETRY)
+		goto retry;
+	count_vm_event(PGFAULT);
+	count_vm_event(SPECULATIVE_PGFAULT);
+	return ret;
+
+retry:
+	count_vm_event(SPECULATIVE_PGFAULT_RETRY);
+	return VM_FAULT_RETRY;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -289,6 +289,9 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
+	/* a huge pmd maps a transparent hugepage, never this small page */
+	if (pmd_trans_huge(*pmd))
+		return NULL;
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
@@ -701,6 +704,51 @@ void page_add_new_anon_rmap(struct page *page,
 		add_page_to_unevictable_list(page);
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/**
+ * hugepage_add_new_anon_rmap - add pmd mapping to a new transparent hugepage
+ * @page:	the head page of the compound page
+ * @vma:	the vm area in which the mapping is added
+ * @address:	the user virtual address mapped, HPAGE_PMD_SIZE aligned
+ *
+ * Same as page_add_new_anon_rmap, but the compound page is accounted as
+ * one NR_ANON_TRANSPARENT_HUGEPAGES unit and is not put on the LRU:
+ * it is only reclaimable after split_huge_page() has broken it up.
+ */
+void hugepage_add_new_anon_rmap(struct page *page,
+	struct vm_area_struct *vma, unsigned long address)
+{
+	struct anon_vma *anon_vma = vma->anon_vma;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+	VM_BUG_ON(!anon_vma);
+	SetPageSwapBacked(page);
+	atomic_set(&page->_mapcount, 0); /* increment count (starts at -1) */
+	anon_vma = (void *) anon_vma + PAGE_MAPPING_ANON;
+	page->mapping = (struct address_space *) anon_vma;
+	page->index = linear_page_index(vma, address);
+	__inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+}
+
+/**
+ * hugepage_remove_rmap - take down the pmd mapping of a transparent hugepage
+ * @page:	the head page of the compound page
+ *
+ * The caller needs to hold the page_table_lock.  A transparent hugepage
+ * is only ever mapped by one pmd, so unlike page_remove_rmap() there is
+ * no racing page_add_anon_rmap to worry about and the anon mapping can
+ * be reset right away: compound pages are not freed through
+ * free_hot_cold_page(), which would otherwise do it.
+ */
+void hugepage_remove_rmap(struct page *page)
+{
+	if (!atomic_add_negative(-1, &page->_mapcount))
+		return;
+	__dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	page->mapping = NULL;
+}
+#endif
+
 /**
  * page_add_file_rmap - add pte mapping to a file page
  * @page: the page to add the mapping to
@@ -36,9 +36,6 @@
 /* How many pages do we try to swap or page in/out together? */
 int page_cluster;
 
-static DEFINE_PER_CPU(struct pagevec[NR_LRU_LISTS], lru_add_pvecs);
-static DEFINE_PER_CPU(struct pagevec, lru_rotate_pvecs);
-
 /*
  * This path almost never happens for VM activity - pages are normally
  * freed via pagevecs.  But it gets used by networking.
@@ -98,57 +95,123 @@ void put_pages_list(struct list_head *pages)
 EXPORT_SYMBOL(put_pages_list);
 
 /*
- * pagevec_move_tail() must be called with IRQ disabled.
- * Otherwise this may cause nasty races.
+ * Per-cpu batches of pages waiting for an LRU operation: being added to
+ * an LRU list, rotated to the tail of the inactive list, activated or
+ * deactivated.  Each batch holds a reference on its pages and is applied
+ * in one pass over zone->lru_lock when it fills up or is drained.
+ *
+ * A batch fills up at its limit, which adapts to contention: it doubles,
+ * up to LRU_BATCH_MAX, whenever a drain has to wait for the lru_lock, and
+ * shrinks back towards PAGEVEC_SIZE while the lock is found free, so that
+ * pages do not linger off the LRU on quiet systems.
+ */
+#define LRU_BATCH_MAX	64
+
+struct lru_batch {
+	unsigned int nr;
+	unsigned int limit;	/* 0 means PAGEVEC_SIZE */
+	struct page *pages[LRU_BATCH_MAX];
+};
+
+static DEFINE_PER_CPU(struct lru_batch[NR_LRU_LISTS], lru_add_batches);
+static DEFINE_PER_CPU(struct lru_batch, lru_rotate_batch);
+static DEFINE_PER_CPU(struct lru_batch, lru_activate_batch);
+static DEFINE_PER_CPU(struct lru_batch, lru_deactivate_batch);
+
+/*
+ * zone->lru_lock for the batched operations, with contention and hold
+ * time accounted in /proc/vmstat.
  */
-static void pagevec_move_tail(struct pagevec *pvec)
+static inline u64 lru_lock_irqsave(struct zone *zone, unsigned long *flags,
+				   bool *contended)
+{
+	if (!spin_trylock_irqsave(&zone->lru_lock, *flags)) {
+		spin_lock_irqsave(&zone->lru_lock, *flags);
+		__count_vm_event(LRU_LOCK_CONTENDED);
+		*contended = true;
+	}
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	return sched_clock();
+#else
+	return 0;
+#endif
+}
+
+static inline void lru_unlock_irqrestore(struct zone *zone,
+					 unsigned long flags, u64 start)
+{
+#ifdef CONFIG_VM_EVENT_COUNTERS
+	__count_vm_events(LRU_LOCK_HOLD_NS, sched_clock() - start);
+#endif
+	spin_unlock_irqrestore(&zone->lru_lock, flags);
+}
+
+static inline unsigned int lru_batch_limit(struct lru_batch *batch)
+{
+	return batch->limit ? batch->limit : PAGEVEC_SIZE;
+}
+
+/*
+ * Add a page to a batch.  Returns true if the batch must be drained.
+ */
+static inline bool lru_batch_add(struct lru_batch *batch, struct page *page)
+{
+	batch->pages[batch->nr++] = page;
+	return batch->nr >= lru_batch_limit(batch);
+}
+
+/*
+ * Apply move_fn to each of the pages under its zone's lru_lock, then drop
+ * the references the batch held on them.  Returns true if the lru_lock
+ * was contended.
+ */
+static bool lru_move_pages(struct page **pages, int nr,
+		void (*move_fn)(struct page *page, struct zone *zone, void *arg),
+		void *arg)
 {
-	int i;
-	int pgmoved = 0;
 	struct zone *zone = NULL;
+	unsigned long flags = 0;
+	bool contended = false;
+	u64 start = 0;
+	int i;
 
-	for (i = 0; i < pagevec_count(pvec); i++) {
-		struct page *page = pvec->pages[i];
+	for (i = 0; i < nr; i++) {
+		struct page *page = pages[i];
 		struct zone *pagezone = page_zone(page);
 
 		if (pagezone != zone) {
 			if (zone)
-				spin_unlock(&zone->lru_lock);
+				lru_unlock_irqrestore(zone, flags, start);
 			zone = pagezone;
-			spin_lock(&zone->lru_lock);
-		}
-		if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
-			int lru = page_lru_base_type(page);
-			list_move_tail(&page->lru, &zone->lru[lru].list);
-			pgmoved++;
+			start = lru_lock_irqsave(zone, &flags, &contended);
 		}
+		(*move_fn)(page, zone, arg);
 	}
 	if (zone)
-		spin_unlock(&zone->lru_lock);
-	__count_vm_events(PGROTATED, pgmoved);
-	release_pages(pvec->pages, pvec->nr, pvec->cold);
-	pagevec_reinit(pvec);
+		lru_unlock_irqrestore(zone, flags, start);
+	release_pages(pages, nr, 0);
+	return contended;
 }
 
 /*
- * Writeback is about to end against a page which has been marked for immediate
- * reclaim.  If it still appears to be reclaimable, move it to the tail of the
- * inactive list.
+ * Must be called with preemption disabled, and with interrupts disabled
+ * for the rotate batch, which is filled from interrupt context.
  */
-void  rotate_reclaimable_page(struct page *page)
+static void lru_batch_drain(struct lru_batch *batch,
+		void (*move_fn)(struct page *page, struct zone *zone, void *arg),
+		void *arg)
 {
-	if (!PageLocked(page) && !PageDirty(page) && !PageActive(page) &&
-	    !PageUnevictable(page) && PageLRU(page)) {
-		struct pagevec *pvec;
-		unsigned long flags;
+	unsigned int limit = lru_batch_limit(batch);
 
-		page_cache_get(page);
-		local_irq_save(flags);
-		pvec = &__get_cpu_var(lru_rotate_pvecs);
-		if (!pagevec_add(pvec, page))
-			pagevec_move_tail(pvec);
-		local_irq_restore(flags);
-	}
+	if (lru_move_pages(batch->pages, batch->nr, move_fn, arg))
+		limit = min_t(unsigned int, limit * 2, LRU_BATCH_MAX);
+	else
+		limit = max_t(unsigned int, limit - limit / 8, PAGEVEC_SIZE);
+	batch->limit = limit;
+
+	__count_vm_event(LRU_BATCH_DRAIN);
+	__count_vm_events(LRU_BATCH_PAGES, batch->nr);
+	batch->nr = 0;
 }
 
 static void update_page_reclaim_stat(struct zone *zone, struct page *page,
@@ -171,14 +234,65 @@ static void update_page_reclaim_stat(struct zone *zone, struct page *page,
 		memcg_reclaim_stat->recent_rotated[file]++;
 }
 
+static void lru_add_fn(struct page *page, struct zone *zone, void *arg)
+{
+	enum lru_list lru = (enum lru_list)(unsigned long)arg;
+	int file = is_file_lru(lru);
+	int active = is_active_lru(lru);
+
+	VM_BUG_ON(PageActive(page));
+	VM_BUG_ON(PageUnevictable(page));
+	VM_BUG_ON(PageLRU(page));
+
+	SetPageLRU(page);
+	if (active)
+		SetPageActive(page);
+	update_page_reclaim_stat(zone, page, file, active);
+	add_page_to_lru_list(zone, page, lru);
+}
+
+static void lru_rotate_fn(struct page *page, struct zone *zone, void *arg)
+{
+	int *pgmoved = arg;
+
+	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+		int lru = page_lru_base_type(page);
+		list_move_tail(&page->lru, &zone->lru[lru].list);
+		(*pgmoved)++;
+	}
+}
+
+static void lru_rotate_drain(struct lru_batch *batch)
+{
+	int pgmoved = 0;
+
+	lru_batch_drain(batch, lru_rotate_fn, &pgmoved);
+	__count_vm_events(PGROTATED, pgmoved);
+}
+
 /*
- * FIXME: speed this up?
+ * Writeback is about to end against a page which has been marked for immediate
+ * reclaim.  If it still appears to be reclaimable, move it to the tail of the
+ * inactive list.
  */
-void activate_page(struct page *page)
+void  rotate_reclaimable_page(struct page *page)
 {
-	struct zone *zone = page_zone(page);
+	if (!PageLocked(page) && !PageDirty(page) && !PageActive(page) &&
+	    !PageUnevictable(page) && PageLRU(page)) {
+		struct lru_batch *batch;
+		unsigned long flags;
 
-	spin_lock_irq(&zone->lru_lock);
+		page_cache_get(page);
+		local_irq_save(flags);
+		batch = &__get_cpu_var(lru_rotate_batch);
+		if (lru_batch_add(batch, page))
+			lru_rotate_drain(batch);
+		local_irq_restore(flags);
+	}
+}
+
+static void lru_activate_fn(struct page *page, struct zone *zone, void *arg)
+{
 	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
 		int file = page_is_file_cache(page);
 		int lru = page_lru_base_type(page);
@@ -191,7 +305,79 @@ void activate_page(struct page *page)
 
 		update_page_reclaim_stat(zone, page, file, 1);
 	}
-	spin_unlock_irq(&zone->lru_lock);
+}
+
+/*
+ * The page is queued on a per-cpu batch and activated when the batch is
+ * drained; until then it stays on the inactive list.
+ */
+void activate_page(struct page *page)
+{
+	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+		struct lru_batch *batch = &get_cpu_var(lru_activate_batch);
+
+		page_cache_get(page);
+		if (lru_batch_add(batch, page))
+			lru_batch_drain(batch, lru_activate_fn, NULL);
+		put_cpu_var(lru_activate_batch);
+	}
+}
+
+/*
+ * Move a page that is no longer of interest to the inactive list.  A clean
+ * page goes to the tail, to be reclaimed next; a dirty one or one under
+ * writeback goes to the head with PG_reclaim set, so that it is rotated to
+ * the tail when its writeback completes.
+ */
+static void lru_deactivate_fn(struct page *page, struct zone *zone, void *arg)
+{
+	int lru, file, active;
+
+	if (!PageLRU(page) || PageUnevictable(page))
+		return;
+
+	/* Some processes are using the page */
+	if (page_mapped(page))
+		return;
+
+	file = page_is_file_cache(page);
+	lru = page_lru_base_type(page);
+	active = PageActive(page);
+	del_page_from_lru_list(zone, page, active ? lru + LRU_ACTIVE : lru);
+	if (active) {
+		ClearPageActive(page);
+		__count_vm_event(PGDEACTIVATE);
+	}
+	ClearPageReferenced(page);
+	add_page_to_lru_list(zone, page, lru);
+
+	if (PageWriteback(page) || PageDirty(page)) {
+		SetPageReclaim(page);
+	} else {
+		list_move_tail(&page->lru, &zone->lru[lru].list);
+		__count_vm_event(PGROTATED);
+	}
+	update_page_reclaim_stat(zone, page, file, 0);
+}
+
+/**
+ * deactivate_page - forcefully deactivate a page
+ * @page: page to deactivate
+ *
+ * This function hints the VM that @page is a good reclaim candidate,
+ * for example if its invalidation fails due to the page being dirty
+ * or under writeback.
+ */
+void deactivate_page(struct page *page)
+{
+	if (PageLRU(page) && !PageUnevictable(page)) {
+		struct lru_batch *batch = &get_cpu_var(lru_deactivate_batch);
+
+		page_cache_get(page);
+		if (lru_batch_add(batch, page))
+			lru_batch_drain(batch, lru_deactivate_fn, NULL);
+		put_cpu_var(lru_deactivate_batch);
+	}
 }
 
 /*
@@ -216,12 +402,12 @@ EXPORT_SYMBOL(mark_page_accessed);
 
 void __lru_cache_add(struct page *page, enum lru_list lru)
 {
-	struct pagevec *pvec = &get_cpu_var(lru_add_pvecs)[lru];
+	struct lru_batch *batch = &get_cpu_var(lru_add_batches)[lru];
 
 	page_cache_get(page);
-	if (!pagevec_add(pvec, page))
-		____pagevec_lru_add(pvec, lru);
-	put_cpu_var(lru_add_pvecs);
+	if (lru_batch_add(batch, page))
+		lru_batch_drain(batch, lru_add_fn, (void *)(unsigned long)lru);
+	put_cpu_var(lru_add_batches);
 }
 
 /**
@@ -265,31 +451,59 @@ void add_page_to_unevictable_list(struct page *page)
 }
 
 /*
- * Drain pages out of the cpu's pagevecs.
+ * Drain pages out of the cpu's LRU batches.
  * Either "cpu" is the current CPU, and preemption has already been
  * disabled; or "cpu" is being hot-unplugged, and is already dead.
  */
 static void drain_cpu_pagevecs(int cpu)
 {
-	struct pagevec *pvecs = per_cpu(lru_add_pvecs, cpu);
-	struct pagevec *pvec;
+	struct lru_batch *batches = per_cpu(lru_add_batches, cpu);
+	struct lru_batch *batch;
 	int lru;
 
 	for_each_lru(lru) {
-		pvec = &pvecs[lru - LRU_BASE];
-		if (pagevec_count(pvec))
-			____pagevec_lru_add(pvec, lru);
+		batch = &batches[lru - LRU_BASE];
+		if (batch->nr)
+			lru_batch_drain(batch, lru_add_fn, (void *)(unsigned long)lru);
 	}
 
-	pvec = &per_cpu(lru_rotate_pvecs, cpu);
-	if (pagevec_count(pvec)) {
+	batch = &per_cpu(lru_rotate_batch, cpu);
+	if (batch->nr) {
 		unsigned long flags;
 
 		/* No harm done if a racing interrupt already did this */
 		local_irq_save(flags);
-		pagevec_move_tail(pvec);
+		if (batch->nr)
+			lru_rotate_drain(batch);
 		local_irq_restore(flags);
 	}
+
+	batch = &per_cpu(lru_activate_batch, cpu);
+	if (batch->nr)
+		lru_batch_drain(batch, lru_activate_fn, NULL);
+
+	batch = &per_cpu(lru_deactivate_batch, cpu);
+	if (batch->nr)
+		lru_batch_drain(batch, lru_deactivate_fn, NULL);
+}
+
+/*
+ * Whether any of the cpu's batches holds pages.  This peeks at another
+ * cpu's batches without synchronization: a batch that is filled right
+ * after the check is no different from one filled after the drain.
+ */
+static bool cpu_has_lru_batches(int cpu)
+{
+	struct lru_batch *batches = per_cpu(lru_add_batches, cpu);
+	int lru;
+
+	for_each_lru(lru) {
+		if (batches[lru - LRU_BASE].nr)
+			return true;
+	}
+	return per_cpu(lru_rotate_batch, cpu).nr ||
+		per_cpu(lru_activate_batch, cpu).nr ||
+		per_cpu(lru_deactivate_batch, cpu).nr;
 }
 
 void lru_add_drain(void)
@@ -303,12 +517,59 @@ static void lru_add_drain_per_cpu(struct work_struct *dummy)
 	lru_add_drain();
 }
 
+/* initialized once by swap_setup(), so that queueing one twice is harmless */
+static DEFINE_PER_CPU(struct work_struct, lru_add_drain_work);
+
 /*
+ * Drain the batches of all cpus.  Only cpus that have pages batched are
+ * sent work, so idle cpus are not disturbed and the caller does not wait
+ * for the keventd of every cpu in the system.
+ *
+ * keventd itself (memory_failure() from the mce work, for instance) must
+ * not wait for keventd: it drains its own cpu and leaves the other cpus'
+ * work queued, without waiting for it or taking the mutex that a waiting
+ * caller may hold.
+ *
  * Returns 0 for success
  */
 int lru_add_drain_all(void)
 {
-	return schedule_on_each_cpu(lru_add_drain_per_cpu);
+	static DEFINE_MUTEX(lock);
+	static struct cpumask has_work;
+	int cpu;
+
+	if (current_is_keventd()) {
+		int this_cpu = get_cpu();
+
+		drain_cpu_pagevecs(this_cpu);
+		for_each_online_cpu(cpu) {
+			if (cpu != this_cpu && cpu_has_lru_batches(cpu))
+				schedule_work_on(cpu,
+					&per_cpu(lru_add_drain_work, cpu));
+		}
+		put_cpu();
+		return 0;
+	}
+
+	mutex_lock(&lock);
+	get_online_cpus();
+	cpumask_clear(&has_work);
+
+	for_each_online_cpu(cpu) {
+		struct work_struct *work = &per_cpu(lru_add_drain_work, cpu);
+
+		if (cpu_has_lru_batches(cpu)) {
+			schedule_work_on(cpu, work);
+			cpumask_set_cpu(cpu, &has_work);
+		}
+	}
+
+	for_each_cpu(cpu, &has_work)
+		flush_work(&per_cpu(lru_add_drain_work, cpu));
+
+	put_online_cpus();
+	mutex_unlock(&lock);
+	return 0;
 }
 
 /*
@@ -402,37 +663,10 @@ EXPORT_SYMBOL(__pagevec_release);
  */
 void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
 {
-	int i;
-	struct zone *zone = NULL;
-
 	VM_BUG_ON(is_unevictable_lru(lru));
 
-	for (i = 0; i < pagevec_count(pvec); i++) {
-		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
-		int file;
-		int active;
-
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
-		}
-		VM_BUG_ON(PageActive(page));
-		VM_BUG_ON(PageUnevictable(page));
-		VM_BUG_ON(PageLRU(page));
-		SetPageLRU(page);
-		active = is_active_lru(lru);
-		file = is_file_lru(lru);
-		if (active)
-			SetPageActive(page);
-		update_page_reclaim_stat(zone, page, file, active);
-		add_page_to_lru_list(zone, page, lru);
-	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
-	release_pages(pvec->pages, pvec->nr, pvec->cold);
+	lru_move_pages(pvec->pages, pagevec_count(pvec), lru_add_fn,
+		       (void *)(unsigned long)lru);
 	pagevec_reinit(pvec);
 }
 
@@ -497,6 +731,11 @@ EXPORT_SYMBOL(pagevec_lookup_tag);
 void __init swap_setup(void)
 {
 	unsigned long megs = totalram_pages >> (20 - PAGE_SHIFT);
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		INIT_WORK(&per_cpu(lru_add_drain_work, cpu),
+			  lru_add_drain_per_cpu);
 
 #ifdef CONFIG_SWAP
 	bdi_init(swapper_space.backing_dev_info);
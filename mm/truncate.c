@@ -331,6 +331,7 @@ unsigned long invalidate_mapping_pages(struct address_space *mapping,
 			struct page *page = pvec.pages[i];
 			pgoff_t index;
 			int lock_failed;
+			int invalidated;
 
 			lock_failed = !trylock_page(page);
 
@@ -347,9 +348,16 @@ unsigned long invalidate_mapping_pages(struct address_space *mapping,
 			if (lock_failed)
 				continue;
 
-			ret += invalidate_inode_page(page);
-
+			invalidated = invalidate_inode_page(page);
 			unlock_page(page);
+			/*
+			 * The caller has no more use for the page: if it is
+			 * dirty or busy and could not be dropped now, make
+			 * it the next one for reclaim to look at.
+			 */
+			if (!invalidated)
+				deactivate_page(page);
+			ret += invalidated;
 			if (next > end)
 				break;
 		}
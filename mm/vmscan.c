@@ -130,6 +130,13 @@ struct scan_control {
 int vm_swappiness = 60;
 long vm_total_pages;	/* The total number of pages which the VM controls */
 
+/*
+ * kswapd is not holding up an allocation, so it isolates pages in bigger
+ * chunks than direct reclaim and takes zone->lru_lock fewer times for the
+ * same amount of scanning.
+ */
+#define KSWAPD_ISOLATE_BATCH	(SWAP_CLUSTER_MAX * 4)
+
 static LIST_HEAD(shrinker_list);
 static DECLARE_RWSEM(shrinker_rwsem);
 
@@ -804,11 +811,6 @@ keep:
 	return nr_reclaimed;
 }
 
-/* LRU Isolation modes. */
-#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
-#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
-#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
-
 /*
  * Attempt to remove the specified page from its LRU.  Only take this page
  * if it is of the appropriate PageActive status.  Pages which are being
@@ -1979,7 +1981,7 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order)
 		.gfp_mask = GFP_KERNEL,
 		.may_unmap = 1,
 		.may_swap = 1,
-		.swap_cluster_max = SWAP_CLUSTER_MAX,
+		.swap_cluster_max = KSWAPD_ISOLATE_BATCH,
 		.swappiness = vm_swappiness,
 		.order = order,
 		.mem_cgroup = NULL,
@@ -0,0 +1,639 @@
+/*
+ * zswap.c - compressed cache for swap pages
+ *
+ * zswap is a frontswap backend: a page that reclaim is about to write to
+ * a swap device is compressed with LZO and kept in a kmalloc()ed buffer
+ * instead, and a later swap-in decompresses it without any I/O.  The pool
+ * grows and shrinks with the number of pages stored in it, up to
+ * max_pool_percent of RAM.  When it is full the oldest pages of the swap
+ * device being written to are decompressed and written back to it, so the
+ * device only sees I/O when the pool is under pressure.
+ *
+ * Pages that do not compress to at most 3/4 of their size are not worth
+ * keeping and go straight to the device.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/module.h>
+#include <linux/cpu.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/frontswap.h>
+#include <linux/rbtree.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/writeback.h>
+#include <linux/lzo.h>
+#include <linux/debugfs.h>
+#include <asm/atomic.h>
+
+/*********************************
+* statistics
+**********************************/
+/* Number of pages currently stored in zswap */
+static atomic_t zswap_stored_pages = ATOMIC_INIT(0);
+/* Bytes of compressed data, including slab rounding */
+static atomic_long_t zswap_pool_total_size = ATOMIC_LONG_INIT(0);
+
+/*
+ * The statistics below are not protected from concurrent access for
+ * performance reasons so they may not be a 100% accurate.  However,
+ * they do provide useful information on roughly how many times a
+ * certain event is occurring.
+ */
+/* Store failed because the pool was full and writeback did not help */
+static u64 zswap_pool_limit_hit;
+/* Pages written back to the swap device when the pool was full */
+static u64 zswap_written_back_pages;
+/* Store failed because the page did not compress well enough */
+static u64 zswap_reject_compress_poor;
+/* Store failed because the entry or the buffer could not be allocated */
+static u64 zswap_reject_alloc_fail;
+/* Store of a page that was already in the pool (its old copy is dropped) */
+static u64 zswap_duplicate_entry;
+
+/*********************************
+* tunables
+**********************************/
+/* Enable/disable zswap (enabled by default, fixed at boot for now) */
+static int zswap_enabled __read_mostly = 1;
+module_param_named(enabled, zswap_enabled, bool, 0444);
+
+/* The maximum percentage of memory that the compressed pool can occupy */
+static unsigned int zswap_max_pool_percent = 20;
+module_param_named(max_pool_percent, zswap_max_pool_percent, uint, 0644);
+
+/* Pages that compress worse than this are not stored */
+#define ZSWAP_MAX_COMPRESSED_SIZE	(PAGE_SIZE * 3 / 4)
+
+/* How many of the oldest pages a full pool tries to write back per store */
+#define ZSWAP_WRITEBACK_BATCH		4
+
+/*********************************
+* data structures
+**********************************/
+/*
+ * struct zswap_entry
+ *
+ * This structure contains the metadata for tracking a single compressed
+ * page within zswap.
+ *
+ * rbnode - links the entry into red-black tree for the appropriate swap type
+ * lru - links the entry into the swap type's LRU, most recent first
+ * refcount - the tree holds one reference while the entry is in it, a
+ *            writeback holds another; protected by the tree lock
+ * offset - the swap offset for the entry.  Index into the red-black tree.
+ * length - the length in bytes of the compressed page data
+ * buf - the compressed data
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	pgoff_t offset;
+	int refcount;
+	unsigned int length;
+	void *buf;
+};
+
+/*
+ * The tree lock in the zswap_tree struct protects a few things:
+ * - the rbtree
+ * - the lru list
+ * - the refcount field of each entry in the tree
+ */
+struct zswap_tree {
+	struct rb_root rbroot;
+	struct list_head lru;
+	spinlock_t lock;
+};
+
+static struct zswap_tree *zswap_trees[MAX_SWAPFILES];
+
+/*********************************
+* zswap entry functions
+**********************************/
+static struct kmem_cache *zswap_entry_cache;
+
+static struct zswap_entry *zswap_entry_cache_alloc(gfp_t gfp)
+{
+	struct zswap_entry *entry;
+
+	entry = kmem_cache_alloc(zswap_entry_cache, gfp);
+	if (!entry)
+		return NULL;
+	entry->refcount = 1;
+	INIT_LIST_HEAD(&entry->lru);
+	return entry;
+}
+
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	atomic_long_sub(ksize(entry->buf), &zswap_pool_total_size);
+	atomic_dec(&zswap_stored_pages);
+	kfree(entry->buf);
+	kmem_cache_free(zswap_entry_cache, entry);
+}
+
+/* caller must hold the tree lock; frees the entry on the last reference */
+static void zswap_entry_put(struct zswap_entry *entry)
+{
+	if (--entry->refcount == 0)
+		zswap_free_entry(entry);
+}
+
+/*********************************
+* rbtree functions
+**********************************/
+static struct zswap_entry *zswap_rb_search(struct rb_root *root, pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (entry->offset > offset)
+			node = node->rb_left;
+		else if (entry->offset < offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * In the case that a entry with the same offset is found, a pointer to
+ * the existing entry is stored in dupentry and the function returns -EEXIST
+ */
+static int zswap_rb_insert(struct rb_root *root, struct zswap_entry *entry,
+			struct zswap_entry **dupentry)
+{
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *myentry;
+
+	while (*link) {
+		parent = *link;
+		myentry = rb_entry(parent, struct zswap_entry, rbnode);
+		if (myentry->offset > entry->offset)
+			link = &(*link)->rb_left;
+		else if (myentry->offset < entry->offset)
+			link = &(*link)->rb_right;
+		else {
+			*dupentry = myentry;
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return 0;
+}
+
+/* caller must hold the tree lock; drops the tree's reference */
+static void zswap_rb_erase(struct zswap_tree *tree, struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &tree->rbroot);
+	list_del_init(&entry->lru);
+	zswap_entry_put(entry);
+}
+
+/*********************************
+* per-cpu code
+**********************************/
+static DEFINE_PER_CPU(unsigned char *, zswap_dstmem);
+static DEFINE_PER_CPU(void *, zswap_wrkmem);
+
+static int __zswap_cpu_notifier(unsigned long action, unsigned long cpu)
+{
+	unsigned char *dst;
+	void *wrk;
+
+	switch (action) {
+	case CPU_UP_PREPARE:
+	case CPU_UP_PREPARE_FROZEN:
+		dst = kmalloc_node(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL,
+				   cpu_to_node(cpu));
+		wrk = kmalloc_node(LZO1X_1_MEM_COMPRESS, GFP_KERNEL,
+				   cpu_to_node(cpu));
+		if (!dst || !wrk) {
+			kfree(dst);
+			kfree(wrk);
+			pr_err("zswap: can't allocate compressor buffers\n");
+			return NOTIFY_BAD;
+		}
+		per_cpu(zswap_dstmem, cpu) = dst;
+		per_cpu(zswap_wrkmem, cpu) = wrk;
+		break;
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+	case CPU_UP_CANCELED:
+	case CPU_UP_CANCELED_FROZEN:
+		kfree(per_cpu(zswap_dstmem, cpu));
+		per_cpu(zswap_dstmem, cpu) = NULL;
+		kfree(per_cpu(zswap_wrkmem, cpu));
+		per_cpu(zswap_wrkmem, cpu) = NULL;
+		break;
+	default:
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int zswap_cpu_notifier(struct notifier_block *nb,
+				unsigned long action, void *pcpu)
+{
+	return __zswap_cpu_notifier(action, (unsigned long)pcpu);
+}
+
+static struct notifier_block zswap_cpu_notifier_block = {
+	.notifier_call = zswap_cpu_notifier
+};
+
+static int zswap_cpu_init(void)
+{
+	unsigned long cpu;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu)
+		if (__zswap_cpu_notifier(CPU_UP_PREPARE, cpu) != NOTIFY_OK)
+			goto cleanup;
+	register_cpu_notifier(&zswap_cpu_notifier_block);
+	put_online_cpus();
+	return 0;
+
+cleanup:
+	for_each_online_cpu(cpu)
+		__zswap_cpu_notifier(CPU_UP_CANCELED, cpu);
+	put_online_cpus();
+	return -ENOMEM;
+}
+
+/*********************************
+* helpers
+**********************************/
+static bool zswap_is_full(void)
+{
+	return totalram_pages * zswap_max_pool_percent / 100 <
+		DIV_ROUND_UP(atomic_long_read(&zswap_pool_total_size),
+			     PAGE_SIZE);
+}
+
+/*********************************
+* writeback code
+**********************************/
+/*
+ * Give the page at @offset back to the swap device: bring it into the
+ * swap cache (read_swap_cache_async() decompresses it from zswap), drop
+ * the compressed copy and start the write.  The clean page is then left
+ * for reclaim, which frees it once the write has finished.  Fails if the
+ * slot was freed meanwhile, or if the page already is in the swap cache
+ * and therefore in use.
+ */
+static int zswap_writeback_entry(unsigned type, pgoff_t offset)
+{
+	swp_entry_t swpentry = swp_entry(type, offset);
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct page *page;
+	int ret = -EEXIST;
+
+	page = find_get_page(&swapper_space, swpentry.val);
+	if (page) {
+		page_cache_release(page);
+		return ret;
+	}
+
+	page = read_swap_cache_async(swpentry, GFP_KERNEL, NULL, 0);
+	if (!page)
+		return -ENOMEM;
+
+	/* we hold another page lock (the one being stored): don't wait */
+	if (!trylock_page(page))
+		goto out;
+	if (!PageSwapCache(page) || page_private(page) != swpentry.val ||
+	    !PageUptodate(page) || PageWriteback(page)) {
+		unlock_page(page);
+		goto out;
+	}
+
+	frontswap_invalidate_page(type, offset);
+	/* move it to the tail of the inactive list after writeback */
+	SetPageReclaim(page);
+	__swap_writepage(page, &wbc);	/* unlocks the page */
+	zswap_written_back_pages++;
+	ret = 0;
+out:
+	page_cache_release(page);
+	return ret;
+}
+
+/*
+ * Make room in a full pool by writing back the oldest pages of the swap
+ * device the new page is going to.  Returns 0 if the pool is no longer
+ * full.
+ */
+static int zswap_shrink(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	pgoff_t offset;
+	int i;
+
+	for (i = 0; i < ZSWAP_WRITEBACK_BATCH && zswap_is_full(); i++) {
+		spin_lock(&tree->lock);
+		if (list_empty(&tree->lru)) {
+			spin_unlock(&tree->lock);
+			break;
+		}
+		entry = list_entry(tree->lru.prev, struct zswap_entry, lru);
+		/* rotate, so that an entry that cannot be written back now
+		 * does not keep all the others from being tried */
+		list_move(&entry->lru, &tree->lru);
+		offset = entry->offset;
+		spin_unlock(&tree->lock);
+
+		zswap_writeback_entry(type, offset);
+	}
+
+	return zswap_is_full() ? -ENOMEM : 0;
+}
+
+/*********************************
+* frontswap hooks
+**********************************/
+/* attempts to compress and store an single page */
+static int zswap_frontswap_store(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *dupentry;
+	unsigned char *src, *dst;
+	size_t dlen;
+	void *buf;
+	int ret;
+
+	if (!zswap_enabled || !tree)
+		return -ENODEV;
+
+	/* reclaim space if needed */
+	if (zswap_is_full() && zswap_shrink(type)) {
+		zswap_pool_limit_hit++;
+		return -ENOMEM;
+	}
+
+	/* allocate entry */
+	entry = zswap_entry_cache_alloc(GFP_NOWAIT | __GFP_NORETRY |
+					__GFP_NOWARN | __GFP_NOMEMALLOC);
+	if (!entry) {
+		zswap_reject_alloc_fail++;
+		return -ENOMEM;
+	}
+
+	/* compress */
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK) {
+		ret = -EINVAL;
+		goto put_dstmem;
+	}
+	if (dlen > ZSWAP_MAX_COMPRESSED_SIZE) {
+		zswap_reject_compress_poor++;
+		ret = -E2BIG;
+		goto put_dstmem;
+	}
+
+	/* store; only dip into free memory that is readily available */
+	buf = kmalloc(dlen, GFP_NOWAIT | __GFP_NORETRY | __GFP_NOWARN |
+			    __GFP_NOMEMALLOC);
+	if (!buf) {
+		zswap_reject_alloc_fail++;
+		ret = -ENOMEM;
+		goto put_dstmem;
+	}
+	memcpy(buf, dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	/* populate entry */
+	entry->offset = offset;
+	entry->buf = buf;
+	entry->length = dlen;
+	atomic_long_add(ksize(buf), &zswap_pool_total_size);
+	atomic_inc(&zswap_stored_pages);
+
+	/* map */
+	spin_lock(&tree->lock);
+	do {
+		ret = zswap_rb_insert(&tree->rbroot, entry, &dupentry);
+		if (ret == -EEXIST) {
+			zswap_duplicate_entry++;
+			zswap_rb_erase(tree, dupentry);
+		}
+	} while (ret == -EEXIST);
+	list_add(&entry->lru, &tree->lru);
+	spin_unlock(&tree->lock);
+
+	return 0;
+
+put_dstmem:
+	put_cpu_var(zswap_dstmem);
+	kmem_cache_free(zswap_entry_cache, entry);
+	return ret;
+}
+
+/*
+ * returns 0 if the page was successfully decompressed
+ * return -1 on entry not found or error
+ */
+static int zswap_frontswap_load(unsigned type, pgoff_t offset,
+				struct page *page)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+	unsigned char *dst;
+	size_t dlen;
+	int ret;
+
+	if (!tree)
+		return -1;
+
+	/* find */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (!entry) {
+		/* entry was written back */
+		spin_unlock(&tree->lock);
+		return -1;
+	}
+	entry->refcount++;
+	spin_unlock(&tree->lock);
+
+	/* decompress */
+	dlen = PAGE_SIZE;
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(entry->buf, entry->length, dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+
+	spin_lock(&tree->lock);
+	zswap_entry_put(entry);
+	spin_unlock(&tree->lock);
+
+	return 0;
+}
+
+/* frees an entry in zswap */
+static void zswap_frontswap_invalidate_page(unsigned type, pgoff_t offset)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry;
+
+	if (!tree)
+		return;
+
+	/* find */
+	spin_lock(&tree->lock);
+	entry = zswap_rb_search(&tree->rbroot, offset);
+	if (entry)
+		zswap_rb_erase(tree, entry);
+	spin_unlock(&tree->lock);
+}
+
+/* frees all zswap entries for the given swap type */
+static void zswap_frontswap_invalidate_area(unsigned type)
+{
+	struct zswap_tree *tree = zswap_trees[type];
+	struct zswap_entry *entry, *n;
+
+	if (!tree)
+		return;
+
+	/* walk the tree and free everything */
+	spin_lock(&tree->lock);
+	list_for_each_entry_safe(entry, n, &tree->lru, lru)
+		zswap_rb_erase(tree, entry);
+	tree->rbroot = RB_ROOT;
+	spin_unlock(&tree->lock);
+
+	zswap_trees[type] = NULL;
+	kfree(tree);
+}
+
+static void zswap_frontswap_init(unsigned type)
+{
+	struct zswap_tree *tree;
+
+	tree = kzalloc(sizeof(struct zswap_tree), GFP_KERNEL);
+	if (!tree) {
+		pr_err("zswap: alloc failed, zswap disabled for swap type %d\n",
+			type);
+		return;
+	}
+
+	tree->rbroot = RB_ROOT;
+	INIT_LIST_HEAD(&tree->lru);
+	spin_lock_init(&tree->lock);
+	zswap_trees[type] = tree;
+}
+
+static struct frontswap_ops zswap_frontswap_ops = {
+	.store = zswap_frontswap_store,
+	.load = zswap_frontswap_load,
+	.invalidate_page = zswap_frontswap_invalidate_page,
+	.invalidate_area = zswap_frontswap_invalidate_area,
+	.init = zswap_frontswap_init
+};
+
+/*********************************
+* debugfs functions
+**********************************/
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *zswap_debugfs_root;
+
+static int zswap_stored_pages_get(void *data, u64 *val)
+{
+	*val = atomic_read(&zswap_stored_pages);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_stored_pages_fops, zswap_stored_pages_get,
+			NULL, "%llu\n");
+
+static int zswap_pool_total_size_get(void *data, u64 *val)
+{
+	*val = atomic_long_read(&zswap_pool_total_size);
+	return 0;
+}
+DEFINE_SIMPLE_ATTRIBUTE(zswap_pool_total_size_fops, zswap_pool_total_size_get,
+			NULL, "%llu\n");
+
+static int __init zswap_debugfs_init(void)
+{
+	if (!debugfs_initialized())
+		return -ENODEV;
+
+	zswap_debugfs_root = debugfs_create_dir("zswap", NULL);
+	if (!zswap_debugfs_root)
+		return -ENOMEM;
+
+	debugfs_create_u64("pool_limit_hit", S_IRUGO,
+			zswap_debugfs_root, &zswap_pool_limit_hit);
+	debugfs_create_u64("written_back_pages", S_IRUGO,
+			zswap_debugfs_root, &zswap_written_back_pages);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_compress_poor);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO,
+			zswap_debugfs_root, &zswap_reject_alloc_fail);
+	debugfs_create_u64("duplicate_entry", S_IRUGO,
+			zswap_debugfs_root, &zswap_duplicate_entry);
+	debugfs_create_file("stored_pages", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_stored_pages_fops);
+	debugfs_create_file("pool_total_size", S_IRUGO,
+			zswap_debugfs_root, NULL, &zswap_pool_total_size_fops);
+
+	return 0;
+}
+#else
+static int __init zswap_debugfs_init(void)
+{
+	return 0;
+}
+#endif
+
+/*********************************
+* module init
+**********************************/
+static int __init init_zswap(void)
+{
+	if (!zswap_enabled)
+		return 0;
+
+	pr_info("loading zswap\n");
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache) {
+		pr_err("zswap: entry cache creation failed\n");
+		goto error;
+	}
+	if (zswap_cpu_init()) {
+		pr_err("zswap: per-cpu initialization failed\n");
+		goto pcpufail;
+	}
+	frontswap_register_ops(&zswap_frontswap_ops);
+	if (zswap_debugfs_init())
+		pr_warning("zswap: debugfs initialization failed\n");
+	return 0;
+pcpufail:
+	kmem_cache_destroy(zswap_entry_cache);
+error:
+	return -ENOMEM;
+}
+/* after debugfs and the slab caches are up, well before any swapon */
+late_initcall(init_zswap);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed cache for swap pages");
@@ -64,6 +64,90 @@ static inline void *load_pointer(struct sk_buff *skb, int k,
 	}
 }
 
+/*
+ * Handle ancillary data, which are impossible (or very difficult)
+ * to get parsing packet contents.  Returns false when the filter
+ * must return 0.
+ */
+static inline bool load_ancillary(struct sk_buff *skb, int k, u32 *A, u32 X)
+{
+	struct nlattr *nla;
+
+	switch (k-SKF_AD_OFF) {
+	case SKF_AD_PROTOCOL:
+		*A = ntohs(skb->protocol);
+		return true;
+	case SKF_AD_PKTTYPE:
+		*A = skb->pkt_type;
+		return true;
+	case SKF_AD_IFINDEX:
+		*A = skb->dev->ifindex;
+		return true;
+	case SKF_AD_NLATTR:
+		if (skb_is_nonlinear(skb))
+			return false;
+		if (skb->len < sizeof(struct nlattr))
+			return false;
+
+		if (*A > skb->len - sizeof(struct nlattr))
+			return false;
+
+		nla = nla_find((struct nlattr *)&skb->data[*A],
+			       skb->len - *A, X);
+		if (nla)
+			*A = (void *)nla - (void *)skb->data;
+		else
+			*A = 0;
+		return true;
+	case SKF_AD_NLATTR_NEST:
+		if (skb_is_nonlinear(skb))
+			return false;
+		if (skb->len < sizeof(struct nlattr))
+			return false;
+
+		if (*A > skb->len - sizeof(struct nlattr))
+			return false;
+
+		nla = (struct nlattr *)&skb->data[*A];
+		if (nla->nla_len > skb->len - *A)
+			return false;
+
+		nla = nla_find_nested(nla, X);
+		if (nla)
+			*A = (void *)nla - (void *)skb->data;
+		else
+			*A = 0;
+		return true;
+	default:
+		return false;
+	}
+}
+
+#ifdef CONFIG_BPF_JIT
+/*
+ * Called by the JIT slow path for negative offsets (SKF_NET_OFF and
+ * SKF_LL_OFF relative loads).  Ancillary offsets are not data loads.
+ */
+void *bpf_internal_load_pointer_neg_helper(struct sk_buff *skb, int k)
+{
+	if (k >= SKF_AD_OFF)
+		return NULL;
+	return __load_pointer(skb, k);
+}
+
+/*
+ * Called by the JIT for loads from the ancillary area it does not
+ * handle inline.  Returns 0 and sets *res, or -EINVAL when the filter
+ * must return 0.
+ */
+int bpf_internal_load_ancillary_helper(struct sk_buff *skb, int k,
+				       u32 A, u32 X, u32 *res)
+{
+	*res = A;
+	return load_ancillary(skb, k, res, X) ? 0 : -EINVAL;
+}
+#endif
+
 /**
  *	sk_filter - run a packet through a socket filter
  *	@sk: sock associated with &sk_buff
@@ -88,8 +172,8 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	rcu_read_lock_bh();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter) {
-		unsigned int pkt_len = sk_run_filter(skb, filter->insns,
-				filter->len);
+		unsigned int pkt_len = SK_RUN_FILTER(filter, skb);
+
 		err = pkt_len ? pskb_trim(skb, pkt_len) : -EPERM;
 	}
 	rcu_read_unlock_bh();
@@ -297,64 +381,9 @@ load_b:
 			return 0;
 		}
 
-		/*
-		 * Handle ancillary data, which are impossible
-		 * (or very difficult) to get parsing packet contents.
-		 */
-		switch (k-SKF_AD_OFF) {
-		case SKF_AD_PROTOCOL:
-			A = ntohs(skb->protocol);
-			continue;
-		case SKF_AD_PKTTYPE:
-			A = skb->pkt_type;
-			continue;
-		case SKF_AD_IFINDEX:
-			A = skb->dev->ifindex;
+		if (load_ancillary(skb, k, &A, X))
 			continue;
-		case SKF_AD_NLATTR: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (skb->len < sizeof(struct nlattr))
-				return 0;
-
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = nla_find((struct nlattr *)&skb->data[A],
-				       skb->len - A, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		case SKF_AD_NLATTR_NEST: {
-			struct nlattr *nla;
-
-			if (skb_is_nonlinear(skb))
-				return 0;
-			if (skb->len < sizeof(struct nlattr))
-				return 0;
-
-			if (A > skb->len - sizeof(struct nlattr))
-				return 0;
-
-			nla = (struct nlattr *)&skb->data[A];
-			if (nla->nla_len > skb->len - A)
-				return 0;
-
-			nla = nla_find_nested(nla, X);
-			if (nla)
-				A = (void *)nla - (void *)skb->data;
-			else
-				A = 0;
-			continue;
-		}
-		default:
-			return 0;
-		}
+		return 0;
 	}
 
 	return 0;
@@ -521,6 +550,9 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 
 	atomic_set(&fp->refcnt, 1);
 	fp->len = fprog->len;
+#ifdef CONFIG_BPF_JIT
+	fp->bpf_func = NULL;
+#endif
 
 	err = sk_chk_filter(fp->insns, fp->len);
 	if (err) {
@@ -528,6 +560,8 @@ int sk_attach_filter(struct sock_fprog *fprog, struct sock *sk)
 		return err;
 	}
 
+	bpf_jit_compile(fp);
+
 	rcu_read_lock_bh();
 	old_fp = rcu_dereference(sk->sk_filter);
 	rcu_assign_pointer(sk->sk_filter, fp);
@@ -417,6 +417,8 @@ int inet_release(struct socket *sock)
 	if (sk) {
 		long timeout;
 
+		sock_rps_reset_flow(sk);
+
 		/* Applications forget to leave groups before exiting */
 		ip_mc_drop_socket(sk);
 
@@ -1223,6 +1225,8 @@ static struct sk_buff *inet_gso_segment(struct sk_buff *skb, int features)
 		       SKB_GSO_UDP |
 		       SKB_GSO_DODGY |
 		       SKB_GSO_TCP_ECN |
+		       SKB_GSO_GRE |
+		       SKB_GSO_IPIP |
 		       0)))
 		goto out;
 
@@ -1318,7 +1322,8 @@ static struct sk_buff **inet_gro_receive(struct sk_buff **head,
 		if (!NAPI_GRO_CB(p)->same_flow)
 			continue;
 
-		iph2 = ip_hdr(p);
+		/* Not ip_hdr(p): behind a tunnel that is the outer header. */
+		iph2 = (struct iphdr *)(p->data + off);
 
 		if ((iph->protocol ^ iph2->protocol) |
 		    (iph->tos ^ iph2->tos) |
@@ -1375,6 +1380,180 @@ out_unlock:
 	return err;
 }
 
+/*
+ * Offload helpers for IPv4 tunnels (GRE, IPIP).  The tunnel protocol
+ * handler validates its own header and hands the inner packet, of
+ * ethertype @type, back to the generic GSO/GRO code.
+ */
+
+/**
+ *	ip_tunnel_gso_segment - segment the packet carried by a tunnel
+ *	@skb: buffer to segment, data at the tunnel header
+ *	@features: features for the output path
+ *	@hlen: length of the tunnel header (0 for IPIP)
+ *	@type: ethertype of the inner packet
+ *
+ *	Segments the inner packet and copies the outer link layer, IP and
+ *	tunnel headers in front of every segment.  The outer IP headers are
+ *	then fixed up by inet_gso_segment().
+ */
+struct sk_buff *ip_tunnel_gso_segment(struct sk_buff *skb, int features,
+				      unsigned int hlen, __be16 type)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	struct sk_buff *nskb;
+	__be16 protocol = skb->protocol;
+	u16 mac_len = skb->mac_len;
+	unsigned int outer_hlen;
+	unsigned int tnl_hlen;
+	unsigned int nhoff;
+
+	if (unlikely(!pskb_may_pull(skb, hlen)))
+		goto out;
+
+	nhoff = skb_network_header(skb) - skb_mac_header(skb);
+	outer_hlen = skb->data - skb_mac_header(skb);
+	tnl_hlen = outer_hlen + hlen;
+
+	/* Present the inner packet as if it was handed to the device. */
+	__skb_pull(skb, hlen);
+	skb_reset_mac_header(skb);
+	skb_reset_network_header(skb);
+	skb->protocol = type;
+
+	/* Only a device doing generic checksums can fill in a checksum
+	 * behind our headers, otherwise it is computed while copying. */
+	if (!(features & NETIF_F_GEN_CSUM))
+		features &= ~NETIF_F_SG;
+
+	segs = skb_gso_segment(skb, features);
+
+	__skb_push(skb, hlen);
+	skb_reset_transport_header(skb);
+	skb_set_mac_header(skb, -(int)outer_hlen);
+	skb_set_network_header(skb, (int)nhoff - (int)outer_hlen);
+	skb->mac_len = mac_len;
+	skb->protocol = protocol;
+
+	if (!segs || IS_ERR(segs))
+		goto out;
+
+	for (nskb = segs; nskb; nskb = nskb->next) {
+		__skb_push(nskb, tnl_hlen);
+		skb_reset_mac_header(nskb);
+		skb_set_network_header(nskb, nhoff);
+		skb_set_transport_header(nskb, outer_hlen);
+		nskb->mac_len = mac_len;
+		nskb->protocol = protocol;
+		memcpy(nskb->data, skb_mac_header(skb), tnl_hlen);
+	}
+
+out:
+	return segs;
+}
+EXPORT_SYMBOL(ip_tunnel_gso_segment);
+
+/**
+ *	ip_tunnel_gro_receive - aggregate the packets carried by a tunnel
+ *	@head: list of held packets
+ *	@skb: buffer received, GRO offset at the tunnel header
+ *	@hlen: length of the tunnel header (0 for IPIP)
+ *	@type: ethertype of the inner packet
+ *
+ *	The caller must already have cleared same_flow on held packets
+ *	whose tunnel header differs.  Called under rcu_read_lock().
+ */
+struct sk_buff **ip_tunnel_gro_receive(struct sk_buff **head,
+				       struct sk_buff *skb,
+				       unsigned int hlen, __be16 type)
+{
+	struct sk_buff **pp = NULL;
+	struct packet_type *ptype;
+	unsigned int off = skb_gro_offset(skb);
+	int nhoff = skb_network_offset(skb);
+	int ip_summed = skb->ip_summed;
+	__wsum csum = skb->csum;
+	void *th;
+
+	if (NAPI_GRO_CB(skb)->encap)
+		goto flush;
+	NAPI_GRO_CB(skb)->encap = 1;
+
+	ptype = gro_find_receive_by_type(type);
+	if (!ptype)
+		goto flush;
+
+	th = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, off + hlen)) {
+		th = skb_gro_header_slow(skb, off + hlen, off);
+		if (unlikely(!th))
+			goto flush;
+	}
+
+	/* The inner transport protocol verifies its checksum against
+	 * skb->csum, which then has to cover the inner packet alone.
+	 * The IP headers sum to zero and need no adjustment.
+	 */
+	switch (skb->ip_summed) {
+	case CHECKSUM_COMPLETE:
+		skb->csum = csum_sub(skb->csum, csum_partial(th, hlen, 0));
+		break;
+	case CHECKSUM_NONE:
+		skb->csum = skb_checksum(skb, off + hlen,
+					 skb->len - off - hlen, 0);
+		skb->ip_summed = CHECKSUM_COMPLETE;
+		break;
+	}
+
+	skb_gro_pull(skb, hlen);
+	skb_set_network_header(skb, skb_gro_offset(skb));
+
+	pp = ptype->gro_receive(head, skb);
+
+	skb_set_network_header(skb, nhoff);
+
+	/* Unless the inner packet was verified, leave the checksum as
+	 * the tunnel receive handler expects it.
+	 */
+	if (skb->ip_summed != CHECKSUM_UNNECESSARY) {
+		skb->ip_summed = ip_summed;
+		skb->csum = csum;
+	}
+
+	return pp;
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+EXPORT_SYMBOL(ip_tunnel_gro_receive);
+
+/**
+ *	ip_tunnel_gro_complete - finish an aggregated tunnel packet
+ *	@skb: buffer to complete, network header at the outer IP header
+ *	@nhoff: offset of the inner network header from skb->data
+ *	@type: ethertype of the inner packet
+ *
+ *	Called under rcu_read_lock().
+ */
+int ip_tunnel_gro_complete(struct sk_buff *skb, int nhoff, __be16 type)
+{
+	struct packet_type *ptype;
+	int outer = skb_network_offset(skb);
+	int err;
+
+	ptype = gro_find_complete_by_type(type);
+	if (WARN_ON(!ptype))
+		return -ENOSYS;
+
+	skb_set_network_header(skb, nhoff);
+	err = ptype->gro_complete(skb);
+	skb_set_network_header(skb, outer);
+
+	return err;
+}
+EXPORT_SYMBOL(ip_tunnel_gro_complete);
+
 int inet_ctl_sock_create(struct sock **sk, unsigned short family,
 			 unsigned short type, unsigned char protocol,
 			 struct net *net)
@@ -125,6 +125,15 @@ static int ipgre_tunnel_bind_dev(struct net_device *dev);
 
 #define HASH_SIZE  16
 
+/* Offloads of a GRE device with neither checksums nor sequence numbers:
+ * its packets are segmented and checksummed by the underlying device,
+ * or in software right before it (see ipgre_gso_segment).  No UFO: GRE
+ * may carry IPv6, whose UFO moves the headers in front of the fragment
+ * header over the tunnel headers.
+ */
+#define IPGRE_FEATURES	(NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HIGHDMA | \
+			 NETIF_F_HW_CSUM | NETIF_F_GSO_SOFTWARE)
+
 static int ipgre_net_id;
 struct ipgre_net {
 	struct ip_tunnel *tunnels[4][HASH_SIZE];
@@ -581,6 +590,12 @@ static int ipgre_rcv(struct sk_buff *skb)
 
 		secpath_reset(skb);
 
+		/* Aggregated by ipgre_gro_receive: the inner packet is
+		 * plain GSO once the outer headers are gone.
+		 */
+		if (skb_is_gso(skb))
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+
 		skb->protocol = gre_proto;
 		/* WCCP version 1 and 2 protocol decoding.
 		 * - Change protocol to IP
@@ -765,7 +780,7 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 	if (skb->protocol == htons(ETH_P_IP)) {
 		df |= (old_iph->frag_off&htons(IP_DF));
 
-		if ((old_iph->frag_off&htons(IP_DF)) &&
+		if ((old_iph->frag_off&htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED, htonl(mtu));
 			ip_rt_put(rt);
@@ -785,7 +800,8 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 			}
 		}
 
-		if (mtu >= IPV6_MIN_MTU && mtu < skb->len - tunnel->hlen + gre_hlen) {
+		if (mtu >= IPV6_MIN_MTU && !skb_is_gso(skb) &&
+		    mtu < skb->len - tunnel->hlen + gre_hlen) {
 			icmpv6_send(skb, ICMPV6_PKT_TOOBIG, 0, mtu, dev);
 			ip_rt_put(rt);
 			goto tx_error;
@@ -805,8 +821,10 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 
 	max_headroom = LL_RESERVED_SPACE(tdev) + gre_hlen;
 
+	/* A cloned GSO skb shares skb_shinfo(), whose gso_type we modify. */
 	if (skb_headroom(skb) < max_headroom || skb_shared(skb)||
-	    (skb_cloned(skb) && !skb_clone_writable(skb, 0))) {
+	    (skb_cloned(skb) &&
+	     (!skb_clone_writable(skb, 0) || skb_is_gso(skb)))) {
 		struct sk_buff *new_skb = skb_realloc_headroom(skb, max_headroom);
 		if (!new_skb) {
 			ip_rt_put(rt);
@@ -821,6 +839,21 @@ static netdev_tx_t ipgre_tunnel_xmit(struct sk_buff *skb, struct net_device *dev
 		old_iph = ip_hdr(skb);
 	}
 
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+	else if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		/* The underlying device can't find a checksum behind
+		 * our headers: finish it now.
+		 */
+		if (skb_checksum_help(skb)) {
+			ip_rt_put(rt);
+			stats->tx_dropped++;
+			dev_kfree_skb(skb);
+			return NETDEV_TX_OK;
+		}
+		old_iph = ip_hdr(skb);
+	}
+
 	skb_reset_transport_header(skb);
 	skb_push(skb, gre_hlen);
 	skb_reset_network_header(skb);
@@ -947,6 +980,15 @@ static int ipgre_tunnel_bind_dev(struct net_device *dev)
 
 	tunnel->hlen = addend;
 
+	/* Checksums and sequence numbers are per packet, they can be
+	 * neither offloaded nor replicated across segments.
+	 */
+	if (dev->type == ARPHRD_IPGRE &&
+	    !(tunnel->parms.o_flags & (GRE_CSUM|GRE_SEQ))) {
+		dev->features |= IPGRE_FEATURES;
+		netif_set_gso_max_size(dev, GSO_MAX_SIZE - addend);
+	}
+
 	return mtu;
 }
 
@@ -1277,9 +1319,107 @@ static void ipgre_fb_tunnel_init(struct net_device *dev)
 }
 
 
+static int ipgre_gso_send_check(struct sk_buff *skb)
+{
+	/* The inner headers are checked when they are segmented. */
+	return 0;
+}
+
+static struct sk_buff *ipgre_gso_segment(struct sk_buff *skb, int features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	unsigned int grehlen = 4;
+	__be16 *greh;
+
+	if (unlikely(!(skb_shinfo(skb)->gso_type & SKB_GSO_GRE)))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, grehlen)))
+		goto out;
+
+	greh = (__be16 *)skb->data;
+	if (greh[0] & ~GRE_KEY)
+		goto out;
+	if (greh[0] & GRE_KEY)
+		grehlen += 4;
+
+	segs = ip_tunnel_gso_segment(skb, features, grehlen, greh[1]);
+out:
+	return segs;
+}
+
+/*
+ * Aggregate IPv4 packets received over GRE without checksums and
+ * sequence numbers.  Held packets only match if the GRE header (flags,
+ * protocol and key) is the same; the inner headers are then compared
+ * by the inner protocols.
+ */
+static struct sk_buff **ipgre_gro_receive(struct sk_buff **head,
+					  struct sk_buff *skb)
+{
+	struct sk_buff *p;
+	unsigned int off = skb_gro_offset(skb);
+	unsigned int grehlen = 4;
+	__be16 *greh;
+
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, off + grehlen)) {
+		greh = skb_gro_header_slow(skb, off + grehlen, off);
+		if (unlikely(!greh))
+			goto flush;
+	}
+
+	if ((greh[0] & ~GRE_KEY) || greh[1] != htons(ETH_P_IP))
+		goto flush;
+
+	if (greh[0] & GRE_KEY) {
+		grehlen += 4;
+		if (skb_gro_header_hard(skb, off + grehlen)) {
+			greh = skb_gro_header_slow(skb, off + grehlen, off);
+			if (unlikely(!greh))
+				goto flush;
+		}
+	}
+
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		if (memcmp(greh, p->data + off, grehlen))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	return ip_tunnel_gro_receive(head, skb, grehlen, greh[1]);
+
+flush:
+	NAPI_GRO_CB(skb)->flush = 1;
+	return NULL;
+}
+
+static int ipgre_gro_complete(struct sk_buff *skb)
+{
+	struct iphdr *iph = ip_hdr(skb);
+	__be16 *greh = (__be16 *)((u8 *)iph + iph->ihl * 4);
+	int nhoff = skb_network_offset(skb) + iph->ihl * 4 + 4;
+	int err;
+
+	if (greh[0] & GRE_KEY)
+		nhoff += 4;
+
+	err = ip_tunnel_gro_complete(skb, nhoff, greh[1]);
+	if (!err)
+		skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
 static const struct net_protocol ipgre_protocol = {
 	.handler	=	ipgre_rcv,
 	.err_handler	=	ipgre_err,
+	.gso_send_check	=	ipgre_gso_send_check,
+	.gso_segment	=	ipgre_gso_segment,
+	.gro_receive	=	ipgre_gro_receive,
+	.gro_complete	=	ipgre_gro_complete,
 	.netns_ok	=	1,
 };
 
@@ -119,6 +119,12 @@
 #define HASH_SIZE  16
 #define HASH(addr) (((__force u32)addr^((__force u32)addr>>4))&0xF)
 
+/* Segmentation and checksums are left to the underlying device, or done
+ * in software right before it (see tunnel4.c).
+ */
+#define IPIP_FEATURES	(NETIF_F_SG | NETIF_F_FRAGLIST | NETIF_F_HIGHDMA | \
+			 NETIF_F_HW_CSUM | NETIF_F_GSO_SOFTWARE | NETIF_F_UFO)
+
 static int ipip_net_id;
 struct ipip_net {
 	struct ip_tunnel *tunnels_r_l[HASH_SIZE];
@@ -453,7 +459,7 @@ static netdev_tx_t ipip_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 		if (skb_dst(skb))
 			skb_dst(skb)->ops->update_pmtu(skb_dst(skb), mtu);
 
-		if ((old_iph->frag_off & htons(IP_DF)) &&
+		if ((old_iph->frag_off & htons(IP_DF)) && !skb_is_gso(skb) &&
 		    mtu < ntohs(old_iph->tot_len)) {
 			icmp_send(skb, ICMP_DEST_UNREACH, ICMP_FRAG_NEEDED,
 				  htonl(mtu));
@@ -476,8 +482,10 @@ static netdev_tx_t ipip_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 	 */
 	max_headroom = (LL_RESERVED_SPACE(tdev)+sizeof(struct iphdr));
 
+	/* A cloned GSO skb shares skb_shinfo(), whose gso_type we modify. */
 	if (skb_headroom(skb) < max_headroom || skb_shared(skb) ||
-	    (skb_cloned(skb) && !skb_clone_writable(skb, 0))) {
+	    (skb_cloned(skb) &&
+	     (!skb_clone_writable(skb, 0) || skb_is_gso(skb)))) {
 		struct sk_buff *new_skb = skb_realloc_headroom(skb, max_headroom);
 		if (!new_skb) {
 			ip_rt_put(rt);
@@ -492,6 +500,21 @@ static netdev_tx_t ipip_tunnel_xmit(struct sk_buff *skb, struct net_device *dev)
 		old_iph = ip_hdr(skb);
 	}
 
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type |= SKB_GSO_IPIP;
+	else if (skb->ip_summed == CHECKSUM_PARTIAL) {
+		/* The underlying device can't find a checksum behind
+		 * our header: finish it now.
+		 */
+		if (skb_checksum_help(skb)) {
+			ip_rt_put(rt);
+			stats->tx_dropped++;
+			dev_kfree_skb(skb);
+			return NETDEV_TX_OK;
+		}
+		old_iph = ip_hdr(skb);
+	}
+
 	skb->transport_header = skb->network_header;
 	skb_push(skb, sizeof(struct iphdr));
 	skb_reset_network_header(skb);
@@ -706,7 +729,9 @@ static void ipip_tunnel_setup(struct net_device *dev)
 	dev->iflink		= 0;
 	dev->addr_len		= 4;
 	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= IPIP_FEATURES;
 	dev->priv_flags		&= ~IFF_XMIT_DST_RELEASE;
+	netif_set_gso_max_size(dev, GSO_MAX_SIZE - sizeof(struct iphdr));
 }
 
 static void ipip_tunnel_init(struct net_device *dev)
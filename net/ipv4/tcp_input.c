@@ -3065,6 +3065,31 @@ static void tcp_fastretrans_alert(struct sock *sk, int pkts_acked, int flag)
 	tcp_xmit_retransmit_queue(sk);
 }
 
+/* Set sk_pacing_rate to twice the current rate (mss * cwnd / srtt), so
+ * that a pacing packet scheduler such as sch_fq can spread a cwnd worth
+ * of packets over an rtt instead of sending it as a single burst.
+ * The socket may lower it with SO_MAX_PACING_RATE.
+ */
+static void tcp_update_pacing_rate(struct sock *sk)
+{
+	const struct tcp_sock *tp = tcp_sk(sk);
+	u64 rate;
+
+	rate = (u64)tp->mss_cache * 2 * (HZ << 3);
+	rate *= max(tp->snd_cwnd, tp->packets_out);
+	/* srtt is in jiffies << 3.  For rtts of about one jiffy or less
+	 * (and before the first measurement) be conservative and assume
+	 * srtt = 1, ie 1/8 jiffy.
+	 */
+	if (tp->srtt > 8 + 2)
+		do_div(rate, tp->srtt);
+	/* sch_fq reads sk_pacing_rate without the socket lock, make sure
+	 * no intermediate value is stored there.
+	 */
+	ACCESS_ONCE(sk->sk_pacing_rate) = min_t(u64, rate,
+						sk->sk_max_pacing_rate);
+}
+
 static void tcp_valid_rtt_meas(struct sock *sk, u32 seq_rtt)
 {
 	tcp_rtt_estimator(sk, seq_rtt);
@@ -3664,6 +3689,8 @@ static int tcp_ack(struct sock *sk, struct sk_buff *skb, int flag)
 			tcp_cong_avoid(sk, ack, prior_in_flight);
 	}
 
+	tcp_update_pacing_rate(sk);
+
 	if ((flag & FLAG_FORWARD_PROGRESS) || !(flag & FLAG_NOT_DUP))
 		dst_confirm(sk->sk_dst_cache);
 
@@ -10,6 +10,7 @@
 #include <linux/skbuff.h>
 #include <net/icmp.h>
 #include <net/ip.h>
+#include <net/ipip.h>
 #include <net/protocol.h>
 #include <net/xfrm.h>
 
@@ -81,6 +82,12 @@ static int tunnel4_rcv(struct sk_buff *skb)
 	if (!pskb_may_pull(skb, sizeof(struct iphdr)))
 		goto drop;
 
+	/* Aggregated by tunnel4_gro_receive: the inner packet is plain
+	 * GSO once the outer header is gone.
+	 */
+	if (skb_is_gso(skb))
+		skb_shinfo(skb)->gso_type &= ~SKB_GSO_IPIP;
+
 	for (handler = tunnel4_handlers; handler; handler = handler->next)
 		if (!handler->handler(skb))
 			return 0;
@@ -132,9 +139,45 @@ static void tunnel64_err(struct sk_buff *skb, u32 info)
 }
 #endif
 
+static int tunnel4_gso_send_check(struct sk_buff *skb)
+{
+	/* The inner headers are checked when they are segmented. */
+	return 0;
+}
+
+static struct sk_buff *tunnel4_gso_segment(struct sk_buff *skb, int features)
+{
+	if (unlikely(!(skb_shinfo(skb)->gso_type & SKB_GSO_IPIP)))
+		return ERR_PTR(-EINVAL);
+
+	return ip_tunnel_gso_segment(skb, features, 0, htons(ETH_P_IP));
+}
+
+static struct sk_buff **tunnel4_gro_receive(struct sk_buff **head,
+					    struct sk_buff *skb)
+{
+	return ip_tunnel_gro_receive(head, skb, 0, htons(ETH_P_IP));
+}
+
+static int tunnel4_gro_complete(struct sk_buff *skb)
+{
+	int nhoff = skb_network_offset(skb) + ip_hdrlen(skb);
+	int err;
+
+	err = ip_tunnel_gro_complete(skb, nhoff, htons(ETH_P_IP));
+	if (!err)
+		skb_shinfo(skb)->gso_type |= SKB_GSO_IPIP;
+
+	return err;
+}
+
 static const struct net_protocol tunnel4_protocol = {
 	.handler	=	tunnel4_rcv,
 	.err_handler	=	tunnel4_err,
+	.gso_send_check	=	tunnel4_gso_send_check,
+	.gso_segment	=	tunnel4_gso_segment,
+	.gro_receive	=	tunnel4_gro_receive,
+	.gro_complete	=	tunnel4_gro_complete,
 	.no_policy	=	1,
 	.netns_ok	=	1,
 };
@@ -520,6 +520,17 @@ int security_inode_permission(struct inode *inode, int mask)
 	return security_ops->inode_permission(inode, mask);
 }
 
+/*
+ * True when no module mediates inode permission checks, i.e. the hook
+ * above never looks at the inode.  Path lookup in rcu-walk mode relies
+ * on this since it checks directories it has not pinned.
+ */
+int security_inode_permission_is_default(void)
+{
+	return security_ops->inode_permission ==
+		default_security_ops.inode_permission;
+}
+
 int security_inode_setattr(struct dentry *dentry, struct iattr *attr)
 {
 	if (unlikely(IS_PRIVATE(dentry->d_inode)))